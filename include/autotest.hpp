@@ -1,15 +1,44 @@
 #pragma once
 #include "types.hpp"
 
+// a button pressed for one frame of a test
+struct ScheduledInput
+{
+    const u32 frameNumber;
+    const u32 buttonIndex;
+    ScheduledInput(u32 frameNumber, u32 buttonIndex);
+};
+
 class Autotest
 {
 public:
+    struct Result
+    {
+        bool passed;
+        u64 frames;        // run until the hash showed up or the budget ran out
+        u32 display_hash;  // of the last frame
+    };
+
     Autotest(const string &testName,
              const string &fileName,              
-             const u32 success_display_hash);
+             const u32 success_display_hash,
+             const vector<ScheduledInput> &inputs = {},
+             const bool known_failure = false);
+
+    const string &name() const;
+    const string &rom() const;
+    // fails on this emulator for now: reported, but not a failed run
+    bool known_failure() const;
+
+    // from power on, pressing the scheduled buttons, until a frame
+    // hashes to success_display_hash or frame_budget frames have run
+    Result run(u64 frame_budget) const;
 private:
     const string testName;
     const string fileName;
     const u32 success_display_hash;
-    
-};
\ No newline at end of file
+    const vector<ScheduledInput> inputs;
+    const bool expected_to_fail;
+};
+
+extern const std::array<Autotest, 7> TEST_LIST;
@@ -2,6 +2,12 @@
 #include "types.hpp"
 
 const u64 SRAM_SIZE_BYTES = 0x2000;
+const u64 CHR_RAM_SIZE_BYTES = 0x2000;
+const u64 PRG_BANK_BYTES = 0x4000;
+const u64 CHR_BANK_BYTES = 0x2000;
+const u64 TRAINER_BYTES = 512;
+const u64 TRAINER_SRAM_OFFSET = 0x1000; // $7000
+const u64 FOUR_SCREEN_VRAM_BYTES = 0x800; // nametables 2 and 3
 
 namespace Cartridge
 {
@@ -13,16 +19,76 @@ namespace Cartridge
         MirrorSingle1 = 3,
         MirrorFour = 4
     };
-    
-    extern vector<u8> prg;
-    extern vector<u8> chr;
+
+    // a ROM file as loaded, never changed afterwards. Loading the same
+    // file again, from any thread, shares the image already in memory,
+    // so only CHR-RAM and SRAM are a machine's own. The file is mapped
+    // read-only rather than read in, so PRG and CHR-ROM are the page
+    // cache's pages. iNES and NES 2.0 headers are both understood, and
+    // the game database corrects them where it knows better.
+    struct Image
+    {
+        const u8 *file = NULL; // the whole file; the pointers below are into it
+        size_t file_size = 0;
+        vector<u8> buffer; // the file read in, where there is no mmap
+        const u8 *trainer; // TRAINER_BYTES for $7000, or NULL
+        const u8 *prg;
+        u32 prg_size;
+        const u8 *chr;    // NULL on boards with CHR-RAM
+        u32 chr_size;     // of CHR-ROM or CHR-RAM
+        u32 prg_ram_size; // bytes at $6000, battery-backed or not
+        vector<u16> tiles; // CHR-ROM pattern rows, see tile_row()
+        u16 mapper;
+        u8 submapper;     // NES 2.0 or the database, else 0
+        MirrorMode mirror_mode;
+        u8 battery;
+        bool nes2;        // the header is NES 2.0
+        u32 crc;          // CRC-32 of the file after the 16 byte header
+        u32 rom_crc;      // CRC-32 of PRG then CHR, the database's key
+        const char *name; // from the database, NULL if it isn't there
+
+        Image() = default;
+        Image(const Image &) = delete; // the pointers are into file
+        ~Image();
+    };
+
+    // a pattern row, both planes, as 8 2-bit pixels with the leftmost
+    // in the low bits
+    inline u16 pattern_row(u8 low, u8 high)
+    {
+        u16 pixels = 0;
+        for (u32 x = 0; x < 8; x++)
+            pixels |= (((low >> (7 - x)) & 1) | ((high >> (7 - x)) & 1) << 1) << (2 * x);
+        return pixels;
+    }
+
+    // where in Image::tiles the row whose first plane is at CHR
+    // offset address is
+    inline u32 tile_row(u32 address)
+    {
+        return address / 16 * 8 + address % 8;
+    }
+
+    // the image for a file, loaded if no machine holds it yet
+    std::shared_ptr<const Image> open(const string &fileName);
+
+    // the image the machine runs, and the fields the hot paths use
+    // copied out of it
+    extern std::shared_ptr<const Image> image;
+    extern const u8 *prg;
+    extern const u8 *chr;      // CHR-ROM, or chr_ram_data
+    extern const u16 *tiles;   // image->tiles, with CHR-ROM
+    extern vector<u8> chr_ram_data;
     extern vector<u8> sram;
-    extern u8 mapper;
+    extern vector<u8> vram; // four-screen boards' own nametables, else empty
+    extern u16 mapper;
     extern MirrorMode mirror_mode;
     extern u8 battery;
+    extern bool chr_ram; // no CHR-ROM, 8KB of CHR-RAM in its place
+    extern u32 crc; // CRC-32 of the file after the 16 byte header
 
     void init(const string &fileName);
     void load(vector<u8> &prg, vector<u8> &chr, u8 mapper, u8 mirror, u8 battery);
 
 
-}
\ No newline at end of file
+}
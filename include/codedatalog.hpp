@@ -0,0 +1,55 @@
+#pragma once
+
+#include "types.hpp"
+
+// code/data log: a byte of flags for every byte of PRG and CHR,
+// or'd in by the mapper on every cartridge read. The CPU and PPU
+// set what kind of access comes next, so marking an access is a
+// single or with no branches. The low bits match the FCEUX .cdl
+// format, so its tools can read the saved logs.
+namespace CodeDataLog
+{
+    // PRG flags
+    const u8 PRG_CODE = 0x01;    // opcode or operand
+    const u8 PRG_DATA = 0x02;    // read by an instruction or an interrupt
+    const u8 PRG_OPCODE = 0x80;  // first byte of an instruction
+
+    // CHR flags
+    const u8 CHR_RENDERED = 0x01; // fetched while drawing
+    const u8 CHR_READ = 0x02;     // read through PPUDATA
+
+    // access kinds, the flags the next access sets
+    const u8 NONE = 0;
+    const u8 OPCODE = PRG_CODE | PRG_OPCODE;
+    const u8 OPERAND = PRG_CODE;
+    const u8 DATA = PRG_DATA;
+
+    extern vector<u8> prg;
+    extern vector<u8> chr;
+    extern u8 cpu_kind;
+    extern u8 ppu_kind;
+
+    // sized to the loaded cartridge, all unmarked
+    void init();
+
+    inline void prg_access(u32 offset)
+    {
+        prg[offset] |= cpu_kind;
+    }
+
+    inline void chr_access(u32 offset)
+    {
+        chr[offset] |= ppu_kind;
+    }
+
+    // a .cdl file: PRG flags then CHR flags. load merges a log
+    // from an earlier session into the current one.
+    void save(const string &file_name);
+    void load(const string &file_name);
+
+    // coverage totals and the PRG ranges marked as code
+    void save_summary(const string &file_name);
+
+    // first bytes of instructions seen so far, for decoding ahead
+    bool is_opcode(u32 prg_offset);
+}
@@ -1,11 +1,34 @@
 #pragma once
 #include "types.hpp"
+#include "scaler.hpp"
+#include "diagpolicy.hpp"
+#include "heatmap.hpp"
 
 namespace Config
 {
     const string WINDOW_NAME { "NES" };
+    const string GAME_DATABASE { "roms/gamedb.bin" }; // header corrections, see gamedb.hpp; "" for none
     const u32 SCREEN_SIZE_MULTIPLIER { 4 };
     const double FRAMERATE { 60.098814 };
     const bool PRINT_FRAME_HASH { false };
-    const bool PRINT_INSTRUCTION { true };
+    const bool INCREMENTAL_FRAME_HASH { true }; // hash each scanline as it is drawn
+    const bool PRINT_INSTRUCTION { false }; // text log of every instruction; --trace records them far cheaper
+    const u64 TRACE_RING_RECORDS { 1 << 20 }; // 32 bytes each, see trace.hpp
+    using DiagPolicy = Diag::All; // categories compiled in, e.g. Diag::Only<Diag::Category::OAM>
+    const u32 DIAG_RING_EVENTS { 1 << 14 }; // per thread, a power of two
+#ifdef NES_HEATMAP
+    using HeatmapPolicy = Heatmap::Counting; // per-address access counts for --heatmap
+#else
+    using HeatmapPolicy = Heatmap::Off;
+#endif
+    const u32 HEATMAP_FRAMES_PER_BUCKET { 1 };
+    const u32 TIMELINE_SPANS { 1 << 21 }; // spans kept by --timeline, about 500 a frame
+    const double METRICS_DUMP_INTERVAL { 1.0 }; // seconds between --metrics dumps
+    const u32 MOVIE_KEYFRAME_INTERVAL { 8 }; // frames between seek keyframes of a played movie, 0 for none
+    const bool VIDEO_SKIP_DUPLICATE_FRAMES { false }; // drop repeated frames from video files, listing the frames kept in <file>.frames; the video then plays static screens too fast
+    const Scaler::Filter DISPLAY_FILTER { Scaler::Filter::None }; // CPU upscaling before the texture
+    const Scaler::Filter VIDEO_FILTER { Scaler::Filter::None }; // for video exports and captures
+    const u32 SCALER_THREADS { 1 };
+    const bool NTSC_FILTER { false }; // composite look for the display, replaces DISPLAY_FILTER
+    const bool NTSC_THREADED { true }; // filter on a worker thread, one frame behind
 }
\ No newline at end of file
@@ -14,6 +14,8 @@ namespace Console
 
     bool init(const string& fileName);
     void run();
+    void reset(); // the reset button, recorded into a movie
     void deinit();
     u32 step();
+    u32 execute(); // step without printing or tracing the instruction
 }
\ No newline at end of file
@@ -4,6 +4,11 @@
 #include <ostream>
 #include <functional>
 
+namespace SaveState
+{
+    class Stream;
+}
+
 namespace CPUMemory
 {
     u8 read(u16 addr);
@@ -76,12 +81,15 @@ namespace CPU
     void setFlags(u8 flags);
     void compare(u8 a, u8 b);
     void reset();
+    void warm_reset();
     void nmi();
     void irq();
     void dispatch(u8 opcode);
     void printInstruction();
     void trigger_nmi();
     void trigger_irq();
+    void trigger_reset(); // at the next instruction, as the reset button
+    void serialize(SaveState::Stream &s);
 
     bool pagesDiffer(u16 a, u16 b);
 
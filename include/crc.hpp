@@ -1,4 +1,25 @@
 #pragma once
 #include "types.hpp"
 
-u32 crc32(const vector<u32> &data);
\ No newline at end of file
+enum class CRCKernel
+{
+    Auto,     // fastest kernels the host supports
+    Portable, // slice-by-8 tables
+    PCLMUL,   // x86 carry-less multiply folding
+    AVX2      // PCLMUL, plus gathered frame hash blocks
+};
+
+// standard CRC-32 (IEEE) of a byte range, continuing from crc
+u32 crc32(const u8 *data, size_t size, u32 crc = 0);
+
+// frame hash of a display buffer, as used by TEST_LIST
+u32 crc32(const vector<u32> &data);
+u32 frame_hash(const u32 *pixels, size_t count);
+
+// incremental frame hashing: hash equally sized parts (e.g. scanlines)
+// with frame_hash_part as they are finished, then combine them in order
+u32 frame_hash_part(const u32 *pixels, size_t count);
+u32 frame_hash_combine(const u32 *parts, size_t num_parts, size_t part_size);
+
+bool crc32_select_kernel(CRCKernel kernel);
+const char *crc32_kernel_name();
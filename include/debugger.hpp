@@ -0,0 +1,66 @@
+#pragma once
+
+#include "types.hpp"
+
+// breakpoints on CPU execution and watchpoints on CPU and PPU
+// bus accesses, with optional register conditions. Each page of
+// each address space has a trap byte that is only non-zero while
+// something on it is watched, so unwatched accesses cost a load
+// and a branch. Hits stop at the next instruction boundary in a
+// command prompt on stdin.
+namespace Debugger
+{
+    const u32 CPU_PAGES = 0x100;
+    const u32 PPU_PAGES = 0x40;
+
+    // trap bytes, per 256-byte page
+    extern array<u8, CPU_PAGES> exec_pages;
+    extern array<u8, CPU_PAGES> cpu_read_pages;
+    extern array<u8, CPU_PAGES> cpu_write_pages;
+    extern array<u8, PPU_PAGES> ppu_read_pages;
+    extern array<u8, PPU_PAGES> ppu_write_pages;
+
+    // set by the quit command; Console::run returns once it is, so
+    // the emulator shuts down the usual way
+    extern bool quit_requested;
+
+    // stop before the next instruction
+    void request_break();
+
+    // runs a command, as typed at the prompt. Returns false when
+    // it resumes emulation.
+    bool command(const string &line);
+    // the prompt, until a command resumes emulation
+    void prompt();
+
+    void on_instruction(u16 pc);
+    void on_cpu_access(u16 address, u8 value, bool write);
+    void on_ppu_access(u16 address, u8 value, bool write);
+
+    // before the instruction at pc runs
+    inline void instruction(u16 pc)
+    {
+        if (exec_pages[pc >> 8]) on_instruction(pc);
+    }
+
+    inline void cpu_read(u16 address)
+    {
+        if (cpu_read_pages[address >> 8]) on_cpu_access(address, 0, false);
+    }
+
+    inline void cpu_write(u16 address, u8 value)
+    {
+        if (cpu_write_pages[address >> 8]) on_cpu_access(address, value, true);
+    }
+
+    // address already reduced to $0000-$3FFF
+    inline void ppu_read(u16 address)
+    {
+        if (ppu_read_pages[address >> 8]) on_ppu_access(address, 0, false);
+    }
+
+    inline void ppu_write(u16 address, u8 value)
+    {
+        if (ppu_write_pages[address >> 8]) on_ppu_access(address, value, true);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "types.hpp"
+#include "diagpolicy.hpp"
+#include "config.hpp"
+#include <atomic>
+#include <cstdio>
+
+// diagnostic events by category. A category is compiled in
+// when Config::DiagPolicy allows it, and then recorded only
+// while enabled at runtime. Events go to a ring buffer owned
+// by the calling thread and are formatted only when dumped.
+namespace Diag
+{
+    struct Event
+    {
+        u64 cycle;
+        const char *format; // printf format taking a and b, a string literal
+        u32 a;
+        u32 b;
+        Category category;
+    };
+
+    extern std::atomic<u32> enabled;
+    void record(Category category, const char *format, u32 a, u32 b);
+
+    // categories by name, "ppuregs,oam", or "all"
+    void enable(const string &names);
+    void disable_all();
+
+    // format every thread's buffered events, oldest first
+    void dump(FILE *fp);
+
+    template <Category category>
+    inline void event(const char *format, u32 a = 0, u32 b = 0)
+    {
+        if constexpr ((Config::DiagPolicy::mask & bit(category)) != 0)
+        {
+            if (enabled.load(std::memory_order_relaxed) & bit(category))
+                record(category, format, a, b);
+        }
+    }
+}
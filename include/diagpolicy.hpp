@@ -0,0 +1,41 @@
+#pragma once
+
+#include "types.hpp"
+
+// categories and compile-time policies of diag.hpp, apart
+// from it so that config.hpp can pick a policy
+namespace Diag
+{
+    enum class Category : u8
+    {
+        CPU,
+        PPURegs,
+        PPUMemory, // nametables and palette
+        OAM,
+        DMA,
+        Mapper,
+        Input,
+        Count
+    };
+
+    constexpr u32 bit(Category category)
+    {
+        return 1u << static_cast<u32>(category);
+    }
+
+    struct None
+    {
+        static constexpr u32 mask = 0;
+    };
+
+    struct All
+    {
+        static constexpr u32 mask = ~0u;
+    };
+
+    template <Category... categories>
+    struct Only
+    {
+        static constexpr u32 mask = (bit(categories) | ... | 0u);
+    };
+}
@@ -2,11 +2,20 @@
 
 #include "types.hpp"
 
+const u32 DISPLAY_WIDTH = 256;  // do not change
+const u32 DISPLAY_HEIGHT = 240;
+
 // contains SDL logic
 // and a buffer for frames
 namespace Display
 {
     void writePixel(u32 u, u32 v, u32 rgb);
+    u32 *row(u32 v);
+    u8 *color_row(u32 v); // NES palette index of each pixel
+    const u32 *frame();
+    const u8 *frame_colors();
+    void end_row(u32 v, u8 emphasis = 0); // emphasis: PPUMASK bits 5-7, shifted down
+    void invalidate();
     void writePixel(u32 u, u32 v, u8 r, u8 g, u8 b);
     void fill(u32 rgb);
     void fill(u8 r, u8 g, u8 b);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "types.hpp"
+
+// game database: what a cartridge really is, for ROMs whose iNES
+// headers get the mapper, mirroring or PRG-RAM wrong. Entries are
+// keyed by the CRC-32 of PRG then CHR, so they match however the
+// header was mangled. tools/gamedb.cpp compiles the text form,
+// roms/gamedb.txt, into the file the loader maps read-only,
+// Config::GAME_DATABASE: a Header, the Entries sorted by crc, then
+// their names as C strings.
+namespace GameDatabase
+{
+    struct Header
+    {
+        char magic[8]; // "NESGDB01"
+        u32 entries;
+        u32 names_size;
+    };
+
+    struct Entry
+    {
+        u32 crc;
+        u32 name;         // offset into the names
+        u32 prg_ram_size; // bytes, battery-backed or not
+        u16 mapper;
+        u8 mirror_mode;   // a Cartridge::MirrorMode
+        u8 flags;         // BATTERY, submapper in the high nibble
+    };
+
+    const u8 BATTERY = 0x01;
+
+    // how the text form writes a Cartridge::MirrorMode, by value
+    const char MIRRORING[] = "HV014";
+
+    // the entry for a cartridge, NULL if it isn't in the database or
+    // there is no database. Maps the file on first use; safe to call
+    // from any thread.
+    const Entry *find(u32 crc);
+    const char *name(const Entry &entry);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "types.hpp"
+
+// per-address read and write counts, bucketed by frame. The bus
+// accessors report every access to Config::HeatmapPolicy, which
+// is Heatmap::Counting when building with NES_HEATMAP (make
+// HEATMAP=1) and Heatmap::Off, compiling to nothing, otherwise.
+namespace Heatmap
+{
+    enum class Region : u8
+    {
+        RAM,             // $0000-$07FF
+        Nametable,       // the 2KB of nametable memory
+        Palette,         // 32 entries, after mirroring
+        OAM,             // OAMDATA and DMA, not sprite evaluation
+        MapperRegisters, // CPU writes to $8000-$FFFF, per 4KB
+        Count
+    };
+
+    const u32 NUM_REGIONS = static_cast<u32>(Region::Count);
+    const array<u32, NUM_REGIONS> REGION_SIZE { 0x800, 0x800, 0x20, 0x100, 8 };
+
+    constexpr u32 region_offset(Region region)
+    {
+        u32 offset = 0;
+        for (u32 i = 0; i < static_cast<u32>(region); i++) offset += REGION_SIZE[i];
+        return offset;
+    }
+
+    const u32 NUM_CELLS = region_offset(Region::Count);
+
+    struct Cell
+    {
+        u32 reads;
+        u32 writes;
+    };
+
+    extern array<Cell, NUM_CELLS> current;
+    void end_frame();
+
+    struct Off
+    {
+        static void read(Region region, u32 index) {}
+        static void write(Region region, u32 index) {}
+        static void frame() {}
+    };
+
+    struct Counting
+    {
+        static void read(Region region, u32 index)
+        {
+            current[region_offset(region) + index].reads++;
+        }
+
+        static void write(Region region, u32 index)
+        {
+            current[region_offset(region) + index].writes++;
+        }
+
+        static void frame()
+        {
+            end_frame();
+        }
+    };
+
+    // writes a bucket of counts to the file every frames_per_bucket
+    // frames, as it closes, so nothing builds up in memory. Only
+    // non-zero cells are written: CSV rows of
+    // frame,region,index,reads,writes when the name ends in .csv,
+    // otherwise binary, a Header and then per bucket a u32 count and
+    // that many SparseCells.
+    void start(const string &file_name, u32 frames_per_bucket);
+    // writes the bucket in progress, however few frames it has
+    void stop();
+
+    struct Header
+    {
+        char magic[8]; // "NESHEAT2"
+        u32 cells;
+        u32 frames_per_bucket;
+        u32 bucket_count;
+        array<u32, NUM_REGIONS> region_size;
+    };
+
+    struct SparseCell
+    {
+        u32 cell; // index over all regions, see region_offset()
+        u32 reads;
+        u32 writes;
+    };
+}
@@ -2,6 +2,11 @@
 #include "types.hpp"
 #include "SDL2/SDL.h"
 
+namespace SaveState
+{
+    class Stream;
+}
+
 namespace Input
 {
     class Controller
@@ -17,6 +22,8 @@ namespace Input
         void write(u8 value);
         u8 read();
         void setButton(u32 buttonIndex, bool down);
+        void setButtons(u8 value); // bit n is button n, as value() returns
+        void serialize(SaveState::Stream &s);
     };
 
     extern Controller controller1;
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.hpp"
+
+// the seek index of a movie: a machine snapshot every interval frames,
+// appended to a sidecar file as playback first reaches them and memory
+// mapped to restore them. Every FULL_EVERY-th keyframe is stored whole
+// and those between as the byte runs that changed since the keyframe
+// before, so a restore decodes at most FULL_EVERY snapshots.
+namespace Keyframes
+{
+    const u32 FULL_EVERY = 64;
+
+    // keeps the keyframes already in the file when it was built for
+    // the same ROM, movie and interval, otherwise starts it over
+    void open(const string &file_name, u32 movie_crc, u32 interval);
+    void close();
+    bool active();
+
+    u32 interval();
+    u64 count(); // keyframe n is at frame n * interval()
+    void add();  // the machine, between instructions, as keyframe count()
+    void restore(u64 n);
+
+    struct Header
+    {
+        char magic[8]; // "NESKEYS1"
+        u32 rom_crc;
+        u32 movie_crc;
+        u32 interval;
+        u32 state_size;
+    };
+
+    // followed by size bytes: the snapshot when full, otherwise runs
+    // of a u32 count of unchanged bytes, a u32 count of changed ones
+    // and the changed bytes
+    struct Record
+    {
+        u32 size;
+        u32 full;
+    };
+}
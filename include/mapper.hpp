@@ -3,6 +3,11 @@
 #include <memory>
 #include "types.hpp"
 
+namespace SaveState
+{
+    class Stream;
+}
+
 class Mapper
 {
 protected:
@@ -11,7 +16,10 @@ public:
     virtual ~Mapper() = 0;
     virtual u8 read(u16 addr) = 0;
     virtual void write(u16 addr, u8 value) = 0;
+    // both planes of the pattern row at addr, as Cartridge::pattern_row
+    virtual u16 read_pattern(u16 addr) = 0;
     virtual void step() = 0;
+    virtual void serialize(SaveState::Stream &s) = 0; // bank registers
 
     static std::unique_ptr<Mapper> generateMapper();
 };
@@ -24,7 +32,9 @@ public:
 private:
     u8 read(u16 addr);
     void write(u16 addr, u8 value);
+    u16 read_pattern(u16 addr);
     void step();
+    void serialize(SaveState::Stream &s);
 
     u32 prgBanks;
     u32 prgBank1;
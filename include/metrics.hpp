@@ -0,0 +1,87 @@
+#pragma once
+
+#include "types.hpp"
+#include <atomic>
+#include <chrono>
+
+// always-on performance counters. Each thread adds to its own
+// cache-line-aligned block of counters without locking or
+// atomic read-modify-writes; reads sum over every thread.
+namespace Metrics
+{
+    enum class Counter : u32
+    {
+        Instructions,
+        CPUCycles,
+        DMAStallCycles,
+        PPUDots,
+        Frames,
+        RegisterReads,                 // 8 counters, $2000-$2007
+        RegisterWrites = RegisterReads + 8,
+        OAMDMATransfers = RegisterWrites + 8,
+        HostStepNs,                    // Console::step loop, includes the three below
+        HostRenderNs,                  // scanline rendering and sprite evaluation
+        HostFlipNs,                    // Display::flip
+        HostEventsNs,                  // SDL event polling
+        Count
+    };
+
+    const u32 NUM_COUNTERS = static_cast<u32>(Counter::Count);
+
+    struct alignas(64) Block
+    {
+        array<std::atomic<u64>, NUM_COUNTERS> values {};
+    };
+
+    extern thread_local Block *block;
+    Block &register_thread();
+
+    inline Block &thread_block()
+    {
+        return block != nullptr ? *block : register_thread();
+    }
+
+    inline void add(Counter counter, u64 amount = 1)
+    {
+        // only the owning thread writes its block, so a plain
+        // load and store is enough and readers never see tearing
+        std::atomic<u64> &value = thread_block().values[static_cast<u32>(counter)];
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    inline Counter register_counter(Counter base, u16 address)
+    {
+        return static_cast<Counter>(static_cast<u32>(base) + (address & 7));
+    }
+
+    // adds the nanoseconds it was alive to a counter
+    struct Timer
+    {
+        Counter counter;
+        std::chrono::steady_clock::time_point start;
+
+        Timer(Counter counter) : counter(counter), start(std::chrono::steady_clock::now()) {}
+
+        ~Timer()
+        {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            add(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    };
+
+    typedef array<u64, NUM_COUNTERS> Snapshot;
+
+    u64 get(Counter counter);
+    Snapshot snapshot();
+    const char *name(Counter counter);
+
+    // totals, plus rates per second over the interval since
+    // previous when one is given
+    string to_text(const Snapshot &current, const Snapshot *previous = nullptr, double seconds = 0);
+    string to_json(const Snapshot &current, const Snapshot *previous = nullptr, double seconds = 0);
+
+    // periodic dumps from Console::run, to a file or "-" for stdout
+    void start_dump(const string &file_name, bool json, double interval_seconds);
+    void poll_dump();
+    void stop_dump();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "types.hpp"
+
+// input movies: the buttons held on both controllers in every frame
+// from power on, and the frames the reset button was pressed in.
+// The PPU reports the end of every frame; recording samples the
+// controllers then, playback sets them for the frame that starts.
+// Input only changes between frames, so playing a movie back on the
+// same ROM reproduces the session exactly, down to the frame hash.
+//
+// Playback also builds a seek index of keyframes next to the movie,
+// <movie>.keys, one every Config::MOVIE_KEYFRAME_INTERVAL frames; see
+// keyframes.hpp. A seek restores the keyframe before the frame and
+// plays the rest of the way.
+namespace Movie
+{
+    enum class Mode
+    {
+        Off,
+        Recording,
+        Playing
+    };
+
+    extern Mode mode;
+    extern bool keyframe_due;
+    void end_frame();
+    void add_keyframe();
+
+    // called by the PPU as frame_count advances
+    inline void frame()
+    {
+        if (mode != Mode::Off) end_frame();
+    }
+
+    // called by the console after every instruction; keyframes are
+    // taken at the first instruction boundary of their frame
+    inline void instruction()
+    {
+        if (keyframe_due) add_keyframe();
+    }
+
+    inline bool playing()
+    {
+        return mode == Mode::Playing;
+    }
+
+    // start at power on, after Console::init. stop() writes a
+    // recording to the file it was started with.
+    void record(const string &file_name);
+    void play(const string &file_name);
+    void stop();
+
+    // the reset button was pressed this frame
+    void reset();
+
+    // to the start of a frame of the movie last played, headless,
+    // then carries on playing from there
+    void seek(u64 frame);
+
+    // frames of input in the movie being recorded or played
+    u64 length();
+
+    // file layout: a Header, resets frame numbers as u32, then runs
+    // Runs of identical input covering frames frames in total
+    struct Header
+    {
+        char magic[8]; // "NESMOVI1"
+        u32 rom_crc;   // Cartridge::crc of the ROM it was recorded on
+        u32 frames;
+        u32 resets;
+        u32 runs;
+    };
+
+    struct Run
+    {
+        u16 frames;
+        u8 controller1; // bit n is button n, as Controller::value()
+        u8 controller2;
+    };
+}
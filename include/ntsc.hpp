@@ -0,0 +1,27 @@
+#pragma once
+
+#include "types.hpp"
+#include "display.hpp"
+
+// NTSC composite video filter. Works from the PPU's palette
+// indices and emphasis bits rather than from RGB, producing
+// two output pixels per NES pixel.
+namespace NTSC
+{
+    const u32 OUTPUT_WIDTH = DISPLAY_WIDTH * 2;
+
+    // filter rows [first, last) of a frame of palette indices.
+    // emphasis holds the PPUMASK emphasis bits (mask >> 5) of
+    // each row, and the parity of frame picks the colour phase.
+    // dst points at output row first and advances dst_pitch bytes.
+    void filter(const u8 *colors, const u8 *emphasis, u64 frame,
+                u32 first, u32 last, void *dst, size_t dst_pitch);
+
+    // hand a frame to the filter thread and return the frame
+    // passed to the previous call, filtered into OUTPUT_WIDTH x
+    // DISPLAY_HEIGHT pixels, or nullptr on the first call
+    const u32 *pipeline(const u8 *colors, const u8 *emphasis, u64 frame);
+    void stop();
+
+    const char *kernel_name();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "types.hpp"
+
+// hardware performance counters from perf_event_open, charged
+// to the emulation phase running when they were read. Phases
+// nest: time spent rendering inside the CPU loop is charged to
+// Render, not Emulation. Counters the kernel refuses (as in most
+// containers) are reported as unavailable; with none at all
+// start() warns and counting stays off.
+namespace PerfCounters
+{
+    enum class Phase : u8
+    {
+        Host,      // outside the emulation loop: pacing and events
+        Emulation, // CPU dispatch and PPU ticks
+        Render,    // scanline rendering and sprite evaluation
+        Flip,      // Display::flip
+        Count
+    };
+
+    enum class Event : u8
+    {
+        Cycles,
+        Instructions,
+        BranchMisses,
+        L1DReadMisses,
+        LLCMisses,
+        Count
+    };
+
+    // per-frame counts go to file_name as CSV when stopped
+    void start(const string &file_name);
+    void stop();
+    bool active();
+
+    extern bool counting;
+    void enter(Phase phase);
+    void leave();
+    void on_frame();
+
+    struct Scope
+    {
+        bool entered;
+
+        Scope(Phase phase) : entered(counting)
+        {
+            if (entered) enter(phase);
+        }
+
+        ~Scope()
+        {
+            if (entered) leave();
+        }
+    };
+
+    // closes the counts of the frame that just ended
+    inline void frame()
+    {
+        if (counting) on_frame();
+    }
+}
@@ -2,9 +2,16 @@
 
 #include "types.hpp"
 
+namespace SaveState
+{
+    class Stream;
+}
+
 namespace PPU
 {
     extern u64 frame_count;
+    extern u32 scan_line;
+    extern u32 dot;
 
     namespace CTRL
     {
@@ -42,6 +49,7 @@ namespace PPU
     {
         extern vector<u8> data;
         extern vector<u8> secondary_data;
+        void dma(u8 value);
         void print_secondary_oam();
     }
 
@@ -54,6 +62,9 @@ namespace PPU
 
     void init();
     void tick();
+    void draw_row();         // the current scan_line
+    void evaluate_sprites(); // for the line after scan_line
     u8 read_register(u16 address);
     void write_register(u16 address, u8 value);
+    void serialize(SaveState::Stream &s);
 }
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "types.hpp"
+
+// 6502 profiler. Keeps a shadow call stack from JSR/RTS and
+// NMI/IRQ/RTI, and charges every instruction's cycles to the
+// current stack and to its PC. Only compiled in when building
+// with NES_PROFILE (make PROFILE=1, the default).
+namespace Profiler
+{
+    void start();
+    void stop();
+    bool active();
+
+    // one line per call stack, "reset_C000;sub_C123 cycles",
+    // the input format of flamegraph.pl and speedscope
+    void save_folded(const string &file_name);
+    // the PCs using the most cycles
+    void save_hotspots(const string &file_name, u32 count = 100);
+
+#ifdef NES_PROFILE
+    extern bool profiling;
+    void on_instruction(u16 pc, u8 opcode, u32 cycles);
+    void on_interrupt(bool nmi);
+    void on_stall(u32 cycles);
+
+    // after the instruction at pc ran, taking cycles
+    inline void instruction(u16 pc, u8 opcode, u32 cycles)
+    {
+        if (profiling) on_instruction(pc, opcode, cycles);
+    }
+
+    // after the CPU jumped to an interrupt handler
+    inline void interrupt(bool nmi)
+    {
+        if (profiling) on_interrupt(nmi);
+    }
+
+    // DMA stall cycles, charged to the current stack
+    inline void stall(u32 cycles)
+    {
+        if (profiling) on_stall(cycles);
+    }
+#else
+    inline void instruction(u16 pc, u8 opcode, u32 cycles) {}
+    inline void interrupt(bool nmi) {}
+    inline void stall(u32 cycles) {}
+#endif
+}
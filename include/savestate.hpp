@@ -0,0 +1,51 @@
+#pragma once
+
+#include "types.hpp"
+#include <type_traits>
+
+// machine snapshots. Every part of the machine that changes while a
+// game runs has a serialize(SaveState::Stream &) that hands its fields
+// to the stream in a fixed order. The same function saves and loads,
+// so the two can never disagree on the layout.
+namespace SaveState
+{
+    class Stream
+    {
+    private:
+        vector<u8> &data;
+        size_t position;
+        bool loading;
+    public:
+        Stream(vector<u8> &data, bool loading);
+        void bytes(void *field, size_t size);
+        bool done() const; // a load used up the whole snapshot
+
+        template <typename T>
+        void field(T &value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "fields are copied as bytes");
+            bytes(&value, sizeof(T));
+        }
+
+        template <typename T, size_t N>
+        void field(array<T, N> &values)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "fields are copied as bytes");
+            bytes(values.data(), sizeof(T) * N);
+        }
+
+        // vectors keep the size they were created with
+        void field(vector<u8> &values)
+        {
+            bytes(values.data(), values.size());
+        }
+    };
+
+    // the mutable part of the machine, taken between instructions.
+    // PRG and CHR-ROM are left out, so a snapshot is mostly RAM,
+    // VRAM and SRAM; the second form reuses the vector's memory.
+    vector<u8> save();
+    void save(vector<u8> &state);
+    // a snapshot taken on the same ROM; throws if it doesn't fit
+    void load(vector<u8> &state);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "types.hpp"
+
+// CPU pixel-art upscalers working on DISPLAY_WIDTH x DISPLAY_HEIGHT
+// frames, used for the display texture and for video exports
+namespace Scaler
+{
+    enum class Filter
+    {
+        None,
+        Nearest2x,
+        Nearest3x,
+        Nearest4x,
+        Scale2x,   // AdvMAME2x / EPX
+        Scale3x,   // AdvMAME3x
+        Smooth2x   // hqx-style: Scale2x rules on YUV similarity, blended edges
+    };
+
+    u32 factor(Filter filter);
+
+    // scale source rows [first, last) into dst, which points at output
+    // row first * factor and advances dst_pitch bytes per output row.
+    // Rows outside [first, last) are only read, as neighbours.
+    void scale(Filter filter, const u32 *src, u32 first, u32 last,
+               void *dst, size_t dst_pitch, u32 threads = 1);
+
+    const char *kernel_name();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.hpp"
+#include "console.hpp"
+#include <functional>
+
+// input search from the current machine state: a beam search over
+// sequences of moves, each a controller 1 button state held for
+// frames_per_move frames. Every level clones the beam's machines
+// with SaveState, plays each move on each clone, scores the RAM the
+// move left behind and keeps the best, distinct, beam children.
+//
+// The machine is one per process, so the workers are processes forked
+// when the search starts: PRG, CHR-ROM and everything decoded from
+// them stay shared, copy on write, and only the snapshots travel,
+// through shared memory. A worker takes the children of a level from
+// its own range of them and steals half of the largest range left
+// when it runs out. Where there is no fork the search runs in this
+// process alone.
+namespace Search
+{
+    using Score = std::function<double(const array<u8, CONSOLE_RAM_BYTES> &ram)>;
+
+    struct Options
+    {
+        vector<u8> moves;       // bit n is button n, as Controller::value()
+        u32 depth;              // moves in a sequence
+        u32 frames_per_move;
+        u32 beam;               // machines kept between levels
+        u32 workers;
+    };
+
+    struct Result
+    {
+        vector<u8> moves; // the best sequence found, one button state per move
+        double score;
+        u64 clones;       // moves played, over all levels
+    };
+
+    // leaves the machine as it found it; call between frames
+    Result run(const Options &options, const Score &score);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "types.hpp"
+#include <chrono>
+
+// host timeline of scoped spans, written out as trace-event
+// JSON for chrome://tracing or Perfetto. Spans go into a
+// buffer allocated by start() and are only serialised by stop().
+namespace Timeline
+{
+    void start(const string &file_name, u32 capacity);
+    void stop(); // writes the file
+    bool active();
+
+    extern bool recording;
+    void record(const char *name, i64 arg,
+                std::chrono::steady_clock::time_point begin,
+                std::chrono::steady_clock::time_point end);
+
+    // a span from construction to destruction. name must be a
+    // string literal; arg is shown alongside it when not negative.
+    struct Scope
+    {
+        const char *name;
+        i64 arg;
+        std::chrono::steady_clock::time_point begin;
+
+        Scope(const char *name, i64 arg = -1) : name(name), arg(arg)
+        {
+            if (recording) begin = std::chrono::steady_clock::now();
+        }
+
+        ~Scope()
+        {
+            if (recording) record(name, arg, begin, std::chrono::steady_clock::now());
+        }
+    };
+}
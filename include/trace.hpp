@@ -0,0 +1,81 @@
+#pragma once
+
+#include "types.hpp"
+#include <limits>
+
+// binary instruction trace recorder. Only compiled in when
+// building with NES_TRACE (make TRACE=1, the default); without
+// it Trace::instruction() is empty and nothing is linked.
+namespace Trace
+{
+    // one record per executed instruction, state before it runs
+    struct Record
+    {
+        u64 cycle;
+        u32 frame;
+        u16 pc;
+        u16 dot;
+        u16 line;
+        u16 vram_address;
+        u16 temp_vram_address;
+        u8 bytes[3]; // opcode and operands
+        u8 size;     // instruction size in bytes
+        u8 a, x, y, p, sp;
+        u8 unused;
+    };
+    static_assert(sizeof(Record) == 32, "trace records are fixed size");
+
+    // traces start with this header. Records form a ring of
+    // capacity entries: with count > capacity the oldest one
+    // is at count % capacity.
+    struct Header
+    {
+        char magic[8];
+        u32 version;
+        u32 record_size;
+        u64 capacity;
+        u64 count;
+    };
+
+    // only instructions inside every range are recorded
+    struct Triggers
+    {
+        u16 pc_first = 0;
+        u16 pc_last = 0xFFFF;
+        u64 frame_first = 0;
+        u64 frame_last = std::numeric_limits<u64>::max();
+        u64 cycle_first = 0;
+        u64 cycle_last = std::numeric_limits<u64>::max();
+    };
+
+    enum class Style
+    {
+        Log,    // logs/mylog.log
+        Console // CPU::printInstruction, with V and T
+    };
+
+    // record into an in-memory ring, or a ring in an mmap'd file
+    void start_memory(u64 capacity, const Triggers &triggers = Triggers());
+    void start_file(const string &file_name, u64 capacity, const Triggers &triggers = Triggers());
+    void save(const string &file_name); // write the in-memory ring out
+    void stop();
+
+    // the current CPU and PPU state, as it would be recorded
+    Record capture();
+
+    // records oldest first
+    vector<Record> load(const string &file_name);
+    string format(const Record &record, Style style = Style::Log);
+
+#ifdef NES_TRACE
+    extern bool recording;
+    void record();
+
+    inline void instruction()
+    {
+        if (recording) record();
+    }
+#else
+    inline void instruction() {}
+#endif
+}
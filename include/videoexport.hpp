@@ -0,0 +1,22 @@
+#pragma once
+
+#include "types.hpp"
+
+// streams finished frames to a file or pipe from a
+// writer thread, so that encoding and disk I/O never
+// run on the emulation thread
+namespace VideoExport
+{
+    enum class Format
+    {
+        Y4M,     // YUV4MPEG2, 4:4:4
+        RGB,     // raw 24-bit RGB frames
+        Indexed  // raw 8-bit NES palette indices
+    };
+
+    Format format_for(const string &file_name);
+    void start(const string &file_name, Format format);
+    void push_frame();
+    void stop(); // throws if a write failed, after which frames were dropped
+    bool active();
+}
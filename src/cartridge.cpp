@@ -1,76 +1,225 @@
-#include <iterator>
 #include <fstream>
 #include <cstdio>
 #include <algorithm>
-#include <cassert>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <mutex>
 #include "cartridge.hpp"
+#include "gamedb.hpp"
+#include "crc.hpp"
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace Cartridge
 {
     const u64 SRAM_SIZE_BYTES = 0x2000;
 
-    vector<u8> prg;
-    vector<u8> chr;
+    std::shared_ptr<const Image> image;
+    const u8 *prg = NULL;
+    const u8 *chr = NULL;
+    const u16 *tiles = NULL;
+    vector<u8> chr_ram_data;
     vector<u8> sram(SRAM_SIZE_BYTES);
-    u8 mapper = 0;
+    vector<u8> vram;
+    u16 mapper = 0;
     MirrorMode mirror_mode = MirrorMode::Horizontal;
     u8 battery = 0;
+    bool chr_ram = false;
+    u32 crc = 0;
 
-    void init(const string &fileName)
+    // images some machine still holds, by file; a file changed on
+    // disk since is loaded again
+    struct Loaded
     {
-        std::ifstream file(fileName, std::ios::in | std::ios::binary);
+        std::weak_ptr<const Image> image;
+        std::filesystem::file_time_type modified;
+        u64 size;
+    };
+
+    std::mutex loaded_lock;
+    std::map<string, Loaded> loaded;
 
+    Image::~Image()
+    {
+#ifdef __unix__
+        if (file != NULL && buffer.empty()) munmap(const_cast<u8 *>(file), file_size);
+#endif
+    }
+
+    void map(const string &fileName, Image &image)
+    {
+#ifdef __unix__
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) throw std::invalid_argument("could not open file");
+        struct stat info;
+        void *p = fstat(fd, &info) == 0 && info.st_size > 0
+            ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (p == MAP_FAILED) throw std::invalid_argument("invalid INES file");
+        image.file = static_cast<const u8 *>(p);
+        image.file_size = info.st_size;
+#else
+        std::ifstream file(fileName, std::ios::in | std::ios::binary);
         if (!file) throw std::invalid_argument("could not open file");
+        image.buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        image.file = image.buffer.data();
+        image.file_size = image.buffer.size();
+#endif
+    }
 
-        file.unsetf(std::ios::skipws);
+    // NES 2.0 ROM sizes: units, or with an MSB nibble of F, 2^E * (2M + 1)
+    u64 rom_size(u8 lsb, u8 msb, u64 unit)
+    {
+        if (msb != 0xF) return (lsb | msb << 8) * unit;
+        if (lsb >> 2 > 32) return UINT64_MAX; // more than any file
+        return (1ull << (lsb >> 2)) * ((lsb & 3) * 2 + 1);
+    }
 
-        file.seekg(0, std::ios::end);
-        // auto fileSize = file.tellg();
-        file.seekg(0, std::ios::beg);
+    // NES 2.0 RAM sizes: 64 << shift bytes, none for 0
+    u32 ram_size(u8 shift)
+    {
+        return shift == 0 ? 0 : 64u << shift;
+    }
 
-        vector<u8> buf((std::istreambuf_iterator<char>(file)),
-                        std::istreambuf_iterator<char>());
+    std::shared_ptr<Image> read(const string &fileName)
+    {
+        auto image = std::make_shared<Image>();
+        map(fileName, *image);
+        const u8 *buf = image->file;
+        size_t fileSize = image->file_size;
 
-        if (buf[0] != 'N' ||
+        if (fileSize < 16 ||
+            buf[0] != 'N' ||
             buf[1] != 'E' ||
             buf[2] != 'S' ||
             buf[3] != 26)
             throw std::invalid_argument("invalid INES file");
 
-        u8 numPRG = buf[4];
-        u8 numCHR = buf[5];
         u8 control1 = buf[6];
-        u8 control2 = buf[7];
-        u8 numRAM = buf[8];
-        (void) numRAM;
-
-        u8 mapper1 = control1 >> 4;
-        u8 mapper2 = control2 >> 4;
-        mapper = mapper1 | (mapper2 << 4);
-
-        u8 trainer = (control1 & 4) == 4;
-        (void) trainer;
-
-        u8 mirror1 = control1 & 1;
-        u8 mirror2 = (control2 >> 3) & 1;
-        mirror_mode = static_cast<MirrorMode>(mirror1 | (mirror2 << 1));
-
-        battery = (control1 >> 1) & 1;
-
-        size_t prgSize = 16384 * numPRG;
-        size_t chrSize = 8192 * std::max<size_t>(1, numCHR);
+        image->nes2 = (buf[7] & 0x0C) == 0x08;
+        // old dumping tools left junk like "DiskDude!" in bytes 7 to 15
+        // of iNES headers; only trust them if 12 to 15 are clear
+        bool junk = !image->nes2 && (buf[12] | buf[13] | buf[14] | buf[15]) != 0;
+        u8 control2 = junk ? 0 : buf[7];
+
+        image->mapper = (control1 >> 4) | (control2 & 0xF0);
+        image->submapper = 0;
+        u64 prgSize = 16384 * buf[4];
+        u64 chrSize = 8192 * buf[5];
+        u32 chrRAMSize = CHR_RAM_SIZE_BYTES;
+        // iNES 1.0 counts PRG-RAM in 8KB units, 0 meaning one
+        image->prg_ram_size = 8192 * std::max<u32>(1, junk ? 0 : buf[8]);
+        if (image->nes2)
+        {
+            image->mapper |= (buf[8] & 0x0F) << 8;
+            image->submapper = buf[8] >> 4;
+            prgSize = rom_size(buf[4], buf[9] & 0x0F, 16384);
+            chrSize = rom_size(buf[5], buf[9] >> 4, 8192);
+            image->prg_ram_size = ram_size(buf[10] & 0x0F) + ram_size(buf[10] >> 4);
+            chrRAMSize = std::max<u32>(chrRAMSize, ram_size(buf[11] & 0x0F) + ram_size(buf[11] >> 4));
+        }
 
-        size_t loc = (trainer ? 528 : 16);
+        if (control1 & 8) image->mirror_mode = MirrorMode::MirrorFour;
+        else image->mirror_mode = control1 & 1 ? MirrorMode::Vertical : MirrorMode::Horizontal;
+        image->battery = (control1 >> 1) & 1;
+
+        // NES 2.0 sizes reach 2^64, so each is checked against what is
+        // left of the file on its own rather than summed
+        bool trainer = (control1 & 4) == 4;
+        size_t loc = (trainer ? 16 + TRAINER_BYTES : 16);
+        if (loc > fileSize || prgSize > fileSize - loc || chrSize > fileSize - loc - prgSize)
+            throw std::invalid_argument("truncated INES file");
+        if (prgSize > UINT32_MAX || chrSize > UINT32_MAX)
+            throw std::invalid_argument("INES ROM too large");
+        // exponent sizes can be anything, but boards switch PRG in
+        // 16KB banks and CHR-ROM fills the 8KB pattern tables, which
+        // the mappers and the tile decoding below rely on
+        if (prgSize == 0 || prgSize % PRG_BANK_BYTES != 0)
+            throw std::invalid_argument("PRG-ROM is not a whole number of 16KB banks");
+        if (chrSize % CHR_BANK_BYTES != 0)
+            throw std::invalid_argument("CHR-ROM is not a whole number of 8KB banks");
+
+        image->trainer = trainer ? buf + 16 : NULL;
+        image->prg = buf + loc;
+        image->prg_size = prgSize;
+        image->chr = chrSize ? buf + loc + prgSize : NULL;
+        image->chr_size = chrSize ? chrSize : chrRAMSize;
+
+        // PRG and CHR are one pass over the file when nothing comes
+        // before them but the header, the file's CRC carrying on
+        // from theirs
+        size_t romEnd = loc + prgSize + chrSize;
+        image->rom_crc = crc32(image->prg, prgSize + chrSize);
+        if (trainer) image->crc = crc32(buf + 16, fileSize - 16);
+        else image->crc = crc32(buf + romEnd, fileSize - romEnd, image->rom_crc);
+
+        image->name = NULL;
+        if (const GameDatabase::Entry *entry = GameDatabase::find(image->rom_crc))
+        {
+            image->mapper = entry->mapper;
+            image->submapper = entry->flags >> 4;
+            image->mirror_mode = static_cast<MirrorMode>(entry->mirror_mode);
+            image->battery = entry->flags & GameDatabase::BATTERY;
+            image->prg_ram_size = entry->prg_ram_size;
+            image->name = GameDatabase::name(*entry);
+        }
 
-        assert(loc == 16);
+        // decoded once here rather than on every fetch while drawing
+        if (image->chr != NULL)
+        {
+            image->tiles.resize(chrSize / 2);
+            for (u32 address = 0; address < chrSize; address += 16)
+                for (u32 row = 0; row < 8; row++)
+                    image->tiles[tile_row(address + row)] =
+                        pattern_row(image->chr[address + row], image->chr[address + row + 8]);
+        }
+        return image;
+    }
 
-        prg = vector<u8>(buf.begin() + loc, buf.begin() + loc + prgSize);
-        if (numCHR) chr = vector<u8>(buf.begin() + loc + prgSize, buf.begin() + loc + prgSize + chrSize);
-        else
+    std::shared_ptr<const Image> open(const string &fileName)
+    {
+        std::error_code error;
+        auto modified = std::filesystem::last_write_time(fileName, error);
+        u64 size = error ? 0 : std::filesystem::file_size(fileName, error);
+        if (error) throw std::invalid_argument("could not open file");
+
+        std::lock_guard<std::mutex> lock(loaded_lock);
+        for (auto i = loaded.begin(); i != loaded.end();)
+            i = i->second.image.expired() && i->first != fileName ? loaded.erase(i) : std::next(i);
+        Loaded &entry = loaded[fileName];
+        std::shared_ptr<const Image> shared = entry.image.lock();
+        if (shared == nullptr || entry.modified != modified || entry.size != size)
         {
-            chr = vector<u8>(chrSize);
-            std::fill(chr.begin(), chr.end(), 0);
+            shared = read(fileName);
+            entry = { shared, modified, size };
         }
+        return shared;
+    }
+
+    void init(const string &fileName)
+    {
+        image = open(fileName);
+        prg = image->prg;
+        tiles = image->tiles.data();
+        mapper = image->mapper;
+        mirror_mode = image->mirror_mode;
+        battery = image->battery;
+        crc = image->crc;
+
+        chr_ram = image->chr == NULL;
+        chr_ram_data.assign(chr_ram ? image->chr_size : 0, 0);
+        chr = chr_ram ? chr_ram_data.data() : image->chr;
+        vram.assign(mirror_mode == MirrorMode::MirrorFour ? FOUR_SCREEN_VRAM_BYTES : 0, 0);
+
+        // the mapper sees one 8KB window of PRG-RAM, mirrored if smaller
+        sram.assign(std::min<u64>(image->prg_ram_size, SRAM_SIZE_BYTES), 0);
+        if (image->trainer != NULL && sram.size() >= TRAINER_SRAM_OFFSET + TRAINER_BYTES)
+            std::copy(image->trainer, image->trainer + TRAINER_BYTES, sram.begin() + TRAINER_SRAM_OFFSET);
     }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,108 @@
+#include "codedatalog.hpp"
+#include "cartridge.hpp"
+#include <stdexcept>
+
+const u32 PRG_BANK_SIZE = 0x4000;
+
+namespace CodeDataLog
+{
+    vector<u8> prg;
+    vector<u8> chr;
+    u8 cpu_kind = NONE;
+    u8 ppu_kind = CHR_RENDERED;
+
+    void init()
+    {
+        prg.assign(Cartridge::image->prg_size, 0);
+        chr.assign(Cartridge::image->chr_size, 0);
+        cpu_kind = NONE;
+        ppu_kind = CHR_RENDERED;
+    }
+
+    void save(const string &file_name)
+    {
+        FILE *fp = fopen(file_name.c_str(), "wb");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+        fwrite(prg.data(), 1, prg.size(), fp);
+        fwrite(chr.data(), 1, chr.size(), fp);
+        fclose(fp);
+    }
+
+    void load(const string &file_name)
+    {
+        FILE *fp = fopen(file_name.c_str(), "rb");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        vector<u8> log(prg.size() + chr.size() + 1);
+        size_t size = fread(log.data(), 1, log.size(), fp);
+        fclose(fp);
+        if (size != prg.size() + chr.size())
+            throw std::runtime_error(file_name + " is not a code/data log for this cartridge");
+
+        for (u32 i = 0; i < prg.size(); i++) prg[i] |= log[i];
+        for (u32 i = 0; i < chr.size(); i++) chr[i] |= log[prg.size() + i];
+    }
+
+    bool is_opcode(u32 prg_offset)
+    {
+        return prg_offset < prg.size() && (prg[prg_offset] & PRG_OPCODE);
+    }
+
+    double percent(u64 part, u64 whole)
+    {
+        return whole == 0 ? 0 : 100.0 * part / whole;
+    }
+
+    void save_summary(const string &file_name)
+    {
+        FILE *fp = fopen(file_name.c_str(), "w");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        u64 code = 0, data = 0, both = 0, opcodes = 0;
+        for (u8 flags : prg)
+        {
+            code += (flags & PRG_CODE) != 0;
+            data += (flags & PRG_DATA) != 0;
+            both += (flags & (PRG_CODE | PRG_DATA)) == (PRG_CODE | PRG_DATA);
+            opcodes += (flags & PRG_OPCODE) != 0;
+        }
+        u64 unmarked = prg.size() - code - data + both;
+
+        u64 rendered = 0, read = 0, chr_unmarked = 0;
+        for (u8 flags : chr)
+        {
+            rendered += (flags & CHR_RENDERED) != 0;
+            read += (flags & CHR_READ) != 0;
+            chr_unmarked += flags == 0;
+        }
+
+        fprintf(fp, "PRG %lu bytes\n", prg.size());
+        fprintf(fp, "  code      %8lu  %6.2f%%  (%lu instructions)\n", code, percent(code, prg.size()), opcodes);
+        fprintf(fp, "  data      %8lu  %6.2f%%\n", data, percent(data, prg.size()));
+        fprintf(fp, "  both      %8lu  %6.2f%%\n", both, percent(both, prg.size()));
+        fprintf(fp, "  unmarked  %8lu  %6.2f%%\n", unmarked, percent(unmarked, prg.size()));
+        fprintf(fp, "CHR %lu bytes\n", chr.size());
+        fprintf(fp, "  rendered  %8lu  %6.2f%%\n", rendered, percent(rendered, chr.size()));
+        fprintf(fp, "  read      %8lu  %6.2f%%\n", read, percent(read, chr.size()));
+        fprintf(fp, "  unmarked  %8lu  %6.2f%%\n", chr_unmarked, percent(chr_unmarked, chr.size()));
+
+        fprintf(fp, "\ncode ranges, PRG offset (16K bank:offset in bank)\n");
+        for (u32 i = 0; i < prg.size(); )
+        {
+            if (!(prg[i] & PRG_CODE))
+            {
+                i++;
+                continue;
+            }
+            u32 first = i;
+            while (i < prg.size() && (prg[i] & PRG_CODE)) i++;
+            fprintf(fp, "  %06X-%06X  (%02X:%04X-%02X:%04X)  %u bytes\n", first, i - 1,
+                    first / PRG_BANK_SIZE, first % PRG_BANK_SIZE, (i - 1) / PRG_BANK_SIZE,
+                    (i - 1) % PRG_BANK_SIZE, i - first);
+        }
+        fclose(fp);
+    }
+}
@@ -7,6 +7,15 @@
 #include "cpu.hpp"
 #include "display.hpp"
 #include "input.hpp"
+#include "videoexport.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
+#include "timeline.hpp"
+#include "perfcounters.hpp"
+#include "codedatalog.hpp"
+#include "movie.hpp"
+#include "debugger.hpp"
+#include "heatmap.hpp"
 #include "SDL2/SDL.h"
 #include "config.hpp"
 #include <chrono>
@@ -18,6 +27,7 @@ const u64 DESYNC_MAX_WRAPAROUND = 10;
     // if we're behind by more frames than this
     // reset the count
 const double PRINT_DELAY = 1 / 1.;
+const SDL_Keycode RESET_KEY = SDLK_r;
 
 namespace Console
 {
@@ -27,6 +37,7 @@ namespace Console
     bool init(const string& fileName)
     {
         Cartridge::init(fileName);
+        CodeDataLog::init();
         mapper = std::move(Mapper::generateMapper());
         CPU::init();
         PPU::init();
@@ -43,6 +54,7 @@ namespace Console
         auto last_print = program_start;
         while (!quit)
         {
+            Timeline::Scope iteration("run");
             current_time = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double> diff = current_time - program_start;
             std::chrono::duration<double> since_last_print = current_time - last_print;
@@ -69,13 +81,21 @@ namespace Console
 
             u64 new_frame_target = PPU::frame_count + render_this_tick;
 
-            while (PPU::frame_count < new_frame_target)
             {
-                step();
+                Metrics::Timer timer(Metrics::Counter::HostStepNs);
+                Timeline::Scope span("cpu_steps", render_this_tick);
+                PerfCounters::Scope phase(PerfCounters::Phase::Emulation);
+                while (PPU::frame_count < new_frame_target && !Debugger::quit_requested)
+                {
+                    step();
+                }
             }
+            if (Debugger::quit_requested) break;
             
             if (render_this_tick == 0) SDL_Delay(1);
 
+            Metrics::Timer events_timer(Metrics::Counter::HostEventsNs);
+            Timeline::Scope events_span("events");
             SDL_Event event;
             while (SDL_PollEvent(&event))
             {
@@ -86,23 +106,57 @@ namespace Console
                         break;
                     case SDL_KEYDOWN:
                     case SDL_KEYUP:
-                        Input::handle_event(event);
+                        if (event.type == SDL_KEYDOWN && event.key.keysym.sym == RESET_KEY)
+                        {
+                            if (!event.key.repeat) reset();
+                        }
+                        else Input::handle_event(event);
+                        break;
+                    case SDL_WINDOWEVENT:
+                        // window contents may have been lost, so
+                        // make sure the next flip presents again
+                        Display::invalidate();
+                        break;
                     default:
                         break;
                 }
             }
+            Metrics::poll_dump();
         }
     }
 
+    void reset()
+    {
+        // a movie being played presses reset itself
+        if (Movie::playing()) return;
+        Movie::reset();
+        CPU::trigger_reset();
+    }
+
     void deinit()
     {
+        Movie::stop();
+        Trace::stop();
+        Metrics::stop_dump();
+        Timeline::stop();
+        Heatmap::stop();
+        PerfCounters::stop();
         Display::deinit();
+        // last, as it throws if writing the video failed
+        VideoExport::stop();
     }
 
     u32 step()
     {
         if (Config::PRINT_INSTRUCTION) CPU::printInstruction();
+        Trace::instruction();
+        return execute();
+    }
+
+    u32 execute()
+    {
         u32 cpu_cycles = CPU::step();
+        Metrics::add(Metrics::Counter::CPUCycles, cpu_cycles);
 
         for (u32 i = 0; i < cpu_cycles; i++)
         {
@@ -110,6 +164,7 @@ namespace Console
             PPU::tick();
             PPU::tick();
         }
+        Movie::instruction();
 
         return cpu_cycles;
     }
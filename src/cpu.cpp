@@ -6,11 +6,20 @@
 #include "console.hpp"
 #include "mapper.hpp"
 #include "input.hpp"
+#include "profiler.hpp"
+#include "diag.hpp"
+#include "metrics.hpp"
+#include "debugger.hpp"
+#include "codedatalog.hpp"
+#include "savestate.hpp"
+#include "config.hpp"
 
 namespace CPUMemory
 {
     u8 read(u16 addr)
     {
+        Debugger::cpu_read(addr);
+        if (addr < 0x2000) Config::HeatmapPolicy::read(Heatmap::Region::RAM, addr % 0x0800);
         if      (addr  < 0x2000) return Console::ram[addr % 0x0800];
         else if (addr  < 0x4000) return PPU::read_register(0x2000 + addr % 8); /* PPU */
         else if (addr == 0x4014) return PPU::read_register(addr); /* PPU */
@@ -26,6 +35,9 @@ namespace CPUMemory
 
     void write(u16 addr, u8 value)
     {
+        Debugger::cpu_write(addr, value);
+        if (addr < 0x2000) Config::HeatmapPolicy::write(Heatmap::Region::RAM, addr % 0x0800);
+        if (addr >= 0x8000) Config::HeatmapPolicy::write(Heatmap::Region::MapperRegisters, (addr >> 12) & 7);
         if      (addr  < 0x2000) Console::ram[addr % 0x0800] = value;
         else if (addr  < 0x4000) PPU::write_register(0x2000 + addr % 8, value);
         else if (addr  < 0x4014) return; /* APU */
@@ -84,6 +96,8 @@ namespace CPU
         {
             stall -= 1;
             cycles += 1;
+            Profiler::stall(1);
+            Metrics::add(Metrics::Counter::DMAStallCycles);
             return 1;
         }
 
@@ -92,10 +106,18 @@ namespace CPU
             case InterruptType::None:
                 break;
             case InterruptType::NMI:
+                CodeDataLog::cpu_kind = CodeDataLog::DATA;
                 nmi();
+                Profiler::interrupt(true);
                 break;
             case InterruptType::IRQ:
+                CodeDataLog::cpu_kind = CodeDataLog::DATA;
                 irq();
+                Profiler::interrupt(false);
+                break;
+            case InterruptType::Reset:
+                CodeDataLog::cpu_kind = CodeDataLog::DATA;
+                warm_reset();
                 break;
             default:
                 throw "unhandled interrupt";
@@ -104,7 +126,11 @@ namespace CPU
 
         interrupt = InterruptType::None;
 
+        u16 pc = PC;
+        Debugger::instruction(pc);
+        CodeDataLog::cpu_kind = CodeDataLog::OPCODE;
         u8 opcode = read(PC);
+        CodeDataLog::cpu_kind = CodeDataLog::OPERAND;
         AddressingMode mode = addressingModes[opcode];
 
         u16 address = 0;
@@ -137,7 +163,9 @@ namespace CPU
                 address = read16bug(static_cast<u8>(read(PC + 1) + X));
                 break;
             case AddressingMode::Indirect:
-                address = read16bug(read16(PC + 1));
+                address = read16(PC + 1);
+                CodeDataLog::cpu_kind = CodeDataLog::DATA; // the pointer
+                address = read16bug(address);
                 break;
             case AddressingMode::IndirectIndexed:
                 address = read16bug(read(PC + 1)) + Y;
@@ -167,19 +195,45 @@ namespace CPU
         info.PC = PC;
         info.mode = mode;
 
+        // immediate operands are read by the instruction itself
+        CodeDataLog::cpu_kind = mode == AddressingMode::Immediate ? CodeDataLog::OPERAND : CodeDataLog::DATA;
         opcodeList[opcode]();
+        CodeDataLog::cpu_kind = CodeDataLog::NONE;
+
+        Profiler::instruction(pc, opcode, cycles - oldCycles);
+        Metrics::add(Metrics::Counter::Instructions);
 
         return static_cast<u32>(cycles - oldCycles);
     }
 
     void trigger_nmi()
     {
-        interrupt = InterruptType::NMI;
+        if (interrupt != InterruptType::Reset) interrupt = InterruptType::NMI;
     }
 
     void trigger_irq()
     {
-        if (I == 0) interrupt = InterruptType::IRQ;
+        if (I == 0 && interrupt != InterruptType::Reset) interrupt = InterruptType::IRQ;
+    }
+
+    void trigger_reset()
+    {
+        interrupt = InterruptType::Reset;
+    }
+
+    void serialize(SaveState::Stream &s)
+    {
+        s.field(cycles);
+        s.field(PC);
+        s.field(SP);
+        s.field(A);
+        s.field(X);
+        s.field(Y);
+        u8 p = flags();
+        s.field(p);
+        setFlags(p);
+        s.field(interrupt);
+        s.field(stall);
     }
 
     void printInstruction()
@@ -214,6 +268,7 @@ namespace CPU
 
     void nmi()
     {
+        Diag::event<Diag::Category::CPU>("[CPU] NMI at PC 0x%04X", PC);
         push16(PC);
         Instructions::php();
         PC = read16(0xFFFA);
@@ -223,6 +278,7 @@ namespace CPU
 
     void irq()
     {
+        Diag::event<Diag::Category::CPU>("[CPU] IRQ at PC 0x%04X", PC);
         push16(PC);
         Instructions::php();
         PC = read16(0xFFFE);
@@ -230,6 +286,17 @@ namespace CPU
         cycles += 7;
     }
 
+    // the reset button: unlike power on, memory and registers other
+    // than the stack pointer and interrupt flag are left alone
+    void warm_reset()
+    {
+        Diag::event<Diag::Category::CPU>("[CPU] Reset at PC 0x%04X", PC);
+        SP -= 3;
+        I = 1;
+        PC = read16(0xFFFC);
+        cycles += 7;
+    }
+
     void reset()
     {
         cycles = 0;
@@ -240,7 +307,9 @@ namespace CPU
         Y = 0;
         interrupt = InterruptType::None;
         stall = 0;
+        CodeDataLog::cpu_kind = CodeDataLog::DATA;
         PC = read16(0xFFFC);
+        CodeDataLog::cpu_kind = CodeDataLog::NONE;
         SP = 0xFD;
         setFlags(0x24);
     }
@@ -1,5 +1,13 @@
 #include "crc.hpp"
 #include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_HAVE_X86 1
+#endif
+
 
 const std::array<u32, 256> crc32_lut 
 {
@@ -69,21 +77,398 @@ const std::array<u32, 256> crc32_lut
     0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
 };
 
-u32 crc32(const vector<u32> &data)
+typedef array<array<u32, 256>, 8> slice_tables_t;
+
+// table k holds the crc of byte i followed by k zero bytes
+slice_tables_t make_slice_tables()
+{
+    slice_tables_t t;
+    t[0] = crc32_lut;
+    for (u32 k = 1; k < 8; k++)
+        for (u32 i = 0; i < 256; i++)
+            t[k][i] = (t[k - 1][i] >> 8) ^ crc32_lut[t[k - 1][i] & 0xFF];
+    return t;
+}
+
+const slice_tables_t crc32_slice = make_slice_tables();
+
+inline u32 load32(const u8 *p)
+{
+    u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v; // assumes a little-endian host
+}
+
+/* Standard CRC-32 kernels, working on the raw (pre-inverted) state */
+
+u32 crc32_bytes_slice8(u32 crc, const u8 *data, size_t size)
+{
+    const slice_tables_t &t = crc32_slice;
+    while (size >= 8)
+    {
+        u32 one = load32(data) ^ crc;
+        u32 two = load32(data + 4);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+              t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+              t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size--)
+        crc = (crc >> 8) ^ crc32_lut[(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+#ifdef CRC_HAVE_X86
+
+/* Carry-less multiplication folding, after Intel's "Fast CRC
+   Computation for Generic Polynomials Using PCLMULQDQ". Folds
+   four 128-bit lanes at a time, then reduces with Barrett.
+   Requires size >= 64 and consumes a multiple of 16 bytes. */
+__attribute__((target("pclmul,sse4.1")))
+inline __m128i load(const u8 *p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+__attribute__((target("pclmul,sse4.1")))
+u32 crc32_fold(u32 crc, const u8 *&data, size_t &size)
+{
+    alignas(16) static const u64 k1k2[] = { 0x0154442BD4, 0x01C6E41596 };
+    alignas(16) static const u64 k3k4[] = { 0x01751997D0, 0x00CCAA009E };
+    alignas(16) static const u64 k5k0[] = { 0x0163CD6124, 0x0000000000 };
+    alignas(16) static const u64 poly[] = { 0x01DB710641, 0x01F7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = load(data + 0x00);
+    x2 = load(data + 0x10);
+    x3 = load(data + 0x20);
+    x4 = load(data + 0x30);
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+    data += 64;
+    size -= 64;
+
+    while (size >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), load(data + 0x00));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), load(data + 0x10));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), load(data + 0x20));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), load(data + 0x30));
+        data += 64;
+        size -= 64;
+    }
+
+    // fold the four lanes into one
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+    for (__m128i next : { x2, x3, x4 })
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+    }
+
+    while (size >= 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, load(data)), x5);
+        data += 16;
+        size -= 16;
+    }
+
+    // 128 -> 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_extract_epi32(x1, 1);
+}
+
+__attribute__((target("pclmul,sse4.1")))
+u32 crc32_bytes_pclmul(u32 crc, const u8 *data, size_t size)
+{
+    if (size >= 64) crc = crc32_fold(crc, data, size);
+    return crc32_bytes_slice8(crc, data, size);
+}
+
+#endif
+
+
+/* Frame hashes
+
+   The frame hash predates this module and is not a standard CRC:
+   the original loop narrowed every u32 pixel to u8 before splitting
+   it into bytes, and shifted the state before indexing the table,
+
+       cval >>= 8;
+       cval ^= crc32_lut[static_cast<u8>(cval ^ byte)];
+
+   The hashes in TEST_LIST depend on both quirks. The update is still
+   linear over GF(2), so one pixel maps the state c to A(c) ^ B(v),
+   where v is the low byte of the pixel. A ignores the low byte of c,
+   so n pixels at once cost three lookups for the state plus one per
+   pixel, and none of the pixel lookups depend on the state. */
+
+u32 legacy_step(u32 cval, u8 byte)
 {
-    u32 cval = 0xFFFFFFFF;
-    std::for_each(data.begin(), data.end(), [&cval](const u8 &val)
+    cval >>= 8;
+    return cval ^ crc32_lut[static_cast<u8>(cval ^ byte)];
+}
+
+u32 legacy_pixel(u32 cval, u8 v)
+{
+    cval = legacy_step(cval, v);
+    cval = legacy_step(cval, 0);
+    cval = legacy_step(cval, 0);
+    return legacy_step(cval, 0);
+}
+
+// a GF(2) linear map on the state, as the images of its 32 bits
+typedef array<u32, 32> linear_map_t;
+
+u32 apply_map(const linear_map_t &m, u32 c)
+{
+    u32 res = 0;
+    for (u32 bit = 0; c; bit++, c >>= 1)
+        if (c & 1) res ^= m[bit];
+    return res;
+}
+
+linear_map_t compose_maps(const linear_map_t &outer, const linear_map_t &inner)
+{
+    linear_map_t m;
+    for (u32 bit = 0; bit < 32; bit++) m[bit] = apply_map(outer, inner[bit]);
+    return m;
+}
+
+// A^n, the effect of n pixels on the state
+linear_map_t state_map(u64 n)
+{
+    linear_map_t one, res;
+    for (u32 bit = 0; bit < 32; bit++)
     {
-        std::array<u8, 4> bytes = { static_cast<u8>(val >>  0),
-                                    static_cast<u8>(val >>  8),
-                                    static_cast<u8>(val >> 16),
-                                    static_cast<u8>(val >> 24) };
+        one[bit] = legacy_pixel(static_cast<u32>(1) << bit, 0);
+        res[bit] = static_cast<u32>(1) << bit;
+    }
+    for (; n; n >>= 1)
+    {
+        if (n & 1) res = compose_maps(one, res);
+        one = compose_maps(one, one);
+    }
+    return res;
+}
+
+const u32 FRAME_HASH_BLOCK = 8;
 
-        std::for_each(bytes.begin(), bytes.end(), [&cval](const u8 &val) 
+// lookup tables for the three live bytes of the state under A^n
+struct StateTables
+{
+    array<array<u32, 256>, 3> t;
+
+    explicit StateTables(u64 n)
+    {
+        linear_map_t m = state_map(n);
+        for (u32 k = 0; k < 3; k++)
+            for (u32 i = 0; i < 256; i++)
+                t[k][i] = apply_map(m, i << (8 * (k + 1)));
+    }
+
+    u32 operator()(u32 c) const
+    {
+        return t[0][(c >> 8) & 0xFF] ^ t[1][(c >> 16) & 0xFF] ^ t[2][c >> 24];
+    }
+};
+
+struct FrameHashTables
+{
+    StateTables one { 1 };
+    StateTables block { FRAME_HASH_BLOCK };
+    // pixel[j][v]: contribution of value v at position j of a block
+    array<array<u32, 256>, FRAME_HASH_BLOCK> pixel;
+
+    FrameHashTables()
+    {
+        linear_map_t m = state_map(0);
+        for (u32 j = FRAME_HASH_BLOCK; j--;)
         {
-            cval >>= 8;
-            cval ^= crc32_lut[static_cast<u8>(cval ^ val)]; 
-        });
-    });
-    return cval ^ 0xFFFFFFFF;
-}
\ No newline at end of file
+            for (u32 v = 0; v < 256; v++) pixel[j][v] = apply_map(m, legacy_pixel(0, v));
+            m = compose_maps(state_map(1), m);
+        }
+    }
+};
+
+const FrameHashTables frame_tables;
+
+/* Frame hash kernels, working on the raw state */
+
+u32 frame_hash_table(u32 c, const u32 *pixels, size_t count)
+{
+    const FrameHashTables &t = frame_tables;
+    while (count >= FRAME_HASH_BLOCK)
+    {
+        c = t.block(c) ^
+            t.pixel[0][pixels[0] & 0xFF] ^ t.pixel[1][pixels[1] & 0xFF] ^
+            t.pixel[2][pixels[2] & 0xFF] ^ t.pixel[3][pixels[3] & 0xFF] ^
+            t.pixel[4][pixels[4] & 0xFF] ^ t.pixel[5][pixels[5] & 0xFF] ^
+            t.pixel[6][pixels[6] & 0xFF] ^ t.pixel[7][pixels[7] & 0xFF];
+        pixels += FRAME_HASH_BLOCK;
+        count -= FRAME_HASH_BLOCK;
+    }
+    while (count--)
+        c = t.one(c) ^ t.pixel[FRAME_HASH_BLOCK - 1][*pixels++ & 0xFF];
+    return c;
+}
+
+#ifdef CRC_HAVE_X86
+
+/* Gathers the eight per-position contributions of a block at once */
+__attribute__((target("avx2")))
+u32 frame_hash_avx2(u32 c, const u32 *pixels, size_t count)
+{
+    const FrameHashTables &t = frame_tables;
+    const int *base = reinterpret_cast<const int *>(t.pixel.data());
+    const __m256i lanes = _mm256_setr_epi32(0, 256, 512, 768, 1024, 1280, 1536, 1792);
+    const __m256i low_byte = _mm256_set1_epi32(0xFF);
+
+    while (count >= FRAME_HASH_BLOCK)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels));
+        v = _mm256_add_epi32(_mm256_and_si256(v, low_byte), lanes);
+        __m256i g = _mm256_i32gather_epi32(base, v, 4);
+        __m128i x = _mm_xor_si128(_mm256_castsi256_si128(g), _mm256_extracti128_si256(g, 1));
+        x = _mm_xor_si128(x, _mm_shuffle_epi32(x, 0x4E));
+        x = _mm_xor_si128(x, _mm_shuffle_epi32(x, 0xB1));
+        c = t.block(c) ^ static_cast<u32>(_mm_cvtsi128_si32(x));
+        pixels += FRAME_HASH_BLOCK;
+        count -= FRAME_HASH_BLOCK;
+    }
+    return frame_hash_table(c, pixels, count);
+}
+
+#endif
+
+struct CRCKernels
+{
+    const char *name;
+    u32 (*bytes)(u32 crc, const u8 *data, size_t size);
+    u32 (*frame)(u32 c, const u32 *pixels, size_t count);
+};
+
+const CRCKernels portable_kernels { "portable", crc32_bytes_slice8, frame_hash_table };
+#ifdef CRC_HAVE_X86
+const CRCKernels pclmul_kernels { "pclmul", crc32_bytes_pclmul, frame_hash_table };
+const CRCKernels avx2_kernels { "pclmul+avx2", crc32_bytes_pclmul, frame_hash_avx2 };
+#endif
+
+const CRCKernels *kernels = &portable_kernels;
+
+bool crc32_select_kernel(CRCKernel kernel)
+{
+#ifdef CRC_HAVE_X86
+    bool pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#else
+    bool pclmul = false;
+    bool avx2 = false;
+#endif
+
+    switch (kernel)
+    {
+        case CRCKernel::Auto:
+            return crc32_select_kernel(CRCKernel::AVX2) ||
+                   crc32_select_kernel(CRCKernel::PCLMUL) ||
+                   crc32_select_kernel(CRCKernel::Portable);
+        case CRCKernel::Portable:
+            kernels = &portable_kernels;
+            return true;
+#ifdef CRC_HAVE_X86
+        case CRCKernel::PCLMUL:
+            if (!pclmul) return false;
+            kernels = &pclmul_kernels;
+            return true;
+        case CRCKernel::AVX2:
+            if (!pclmul || !avx2) return false;
+            kernels = &avx2_kernels;
+            return true;
+#endif
+        default:
+            (void) pclmul;
+            (void) avx2;
+            return false;
+    }
+}
+
+const bool kernel_selected = crc32_select_kernel(CRCKernel::Auto);
+
+const char *crc32_kernel_name()
+{
+    return kernels->name;
+}
+
+u32 crc32(const u8 *data, size_t size, u32 crc)
+{
+    return ~kernels->bytes(~crc, data, size);
+}
+
+u32 crc32(const vector<u32> &data)
+{
+    return frame_hash(data.data(), data.size());
+}
+
+u32 frame_hash(const u32 *pixels, size_t count)
+{
+    return ~kernels->frame(0xFFFFFFFF, pixels, count);
+}
+
+u32 frame_hash_part(const u32 *pixels, size_t count)
+{
+    return kernels->frame(0, pixels, count);
+}
+
+// the tables moving the state past part_size pixels, built once per
+// size and never freed, so threads hashing at once can share them
+const StateTables &shift_tables(size_t part_size)
+{
+    static std::mutex lock;
+    static std::map<size_t, unique_ptr<StateTables>> tables;
+    std::lock_guard<std::mutex> guard(lock);
+    unique_ptr<StateTables> &shift = tables[part_size];
+    if (!shift) shift = std::make_unique<StateTables>(part_size);
+    return *shift;
+}
+
+u32 frame_hash_combine(const u32 *parts, size_t num_parts, size_t part_size)
+{
+    const StateTables &shift = shift_tables(part_size);
+
+    // the state is affine in the pixels, so each part's hash from a
+    // zero state is xored onto the running state moved past the part
+    u32 c = 0xFFFFFFFF;
+    for (size_t i = 0; i < num_parts; i++) c = shift(c) ^ parts[i];
+    return ~c;
+}
@@ -0,0 +1,399 @@
+#include "debugger.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+
+const u8 TRAP_WATCHED = 1;
+const u8 TRAP_BREAK = 2; // exec_pages only, a requested stop
+
+namespace Debugger
+{
+    enum class Space : u8
+    {
+        Execute,
+        CPU,
+        PPU
+    };
+
+    enum class Op : u8
+    {
+        Always,
+        Equal,
+        NotEqual,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual
+    };
+
+    // "a==10", compared against a CPU register or the written value
+    struct Condition
+    {
+        string text;
+        string reg;
+        Op op = Op::Always;
+        u32 value = 0;
+    };
+
+    struct Watch
+    {
+        u32 id;
+        Space space;
+        bool read;
+        bool write;
+        u16 first;
+        u16 last;
+        Condition condition;
+    };
+
+    array<u8, CPU_PAGES> exec_pages {};
+    array<u8, CPU_PAGES> cpu_read_pages {};
+    array<u8, CPU_PAGES> cpu_write_pages {};
+    array<u8, PPU_PAGES> ppu_read_pages {};
+    array<u8, PPU_PAGES> ppu_write_pages {};
+
+    vector<Watch> watches;
+    u32 next_id = 1;
+    u64 steps_left = 0;
+    bool in_prompt = false; // the prompt's own bus reads never hit
+    bool quit_requested = false;
+
+    template <size_t N>
+    void mark(array<u8, N> &pages, u16 first, u16 last)
+    {
+        for (u32 page = first >> 8; page <= static_cast<u32>(last >> 8) && page < N; page++)
+            pages[page] |= TRAP_WATCHED;
+    }
+
+    void rebuild_pages()
+    {
+        for (u8 &trap : exec_pages) trap &= ~TRAP_WATCHED;
+        cpu_read_pages.fill(0);
+        cpu_write_pages.fill(0);
+        ppu_read_pages.fill(0);
+        ppu_write_pages.fill(0);
+
+        for (const Watch &w : watches)
+        {
+            switch (w.space)
+            {
+                case Space::Execute:
+                    mark(exec_pages, w.first, w.last);
+                    break;
+                case Space::CPU:
+                    if (w.read) mark(cpu_read_pages, w.first, w.last);
+                    if (w.write) mark(cpu_write_pages, w.first, w.last);
+                    break;
+                case Space::PPU:
+                    if (w.read) mark(ppu_read_pages, w.first, w.last);
+                    if (w.write) mark(ppu_write_pages, w.first, w.last);
+                    break;
+            }
+        }
+    }
+
+    void request_break()
+    {
+        if (steps_left == 0) steps_left = 1;
+        for (u8 &trap : exec_pages) trap |= TRAP_BREAK;
+    }
+
+    void clear_break()
+    {
+        steps_left = 0;
+        for (u8 &trap : exec_pages) trap &= ~TRAP_BREAK;
+    }
+
+    bool holds(const Condition &c, u8 value)
+    {
+        if (c.op == Op::Always) return true;
+
+        u32 lhs;
+        if      (c.reg == "a") lhs = CPU::A;
+        else if (c.reg == "x") lhs = CPU::X;
+        else if (c.reg == "y") lhs = CPU::Y;
+        else if (c.reg == "sp") lhs = CPU::SP;
+        else if (c.reg == "p") lhs = CPU::flags();
+        else if (c.reg == "pc") lhs = CPU::PC;
+        else lhs = value;
+
+        switch (c.op)
+        {
+            case Op::Equal:        return lhs == c.value;
+            case Op::NotEqual:     return lhs != c.value;
+            case Op::Less:         return lhs < c.value;
+            case Op::LessEqual:    return lhs <= c.value;
+            case Op::Greater:      return lhs > c.value;
+            case Op::GreaterEqual: return lhs >= c.value;
+            default:               return true;
+        }
+    }
+
+    void on_instruction(u16 pc)
+    {
+        if (in_prompt) return;
+
+        // breakpoints first, so a step of many stops at one on the way
+        for (const Watch &w : watches)
+        {
+            if (w.space == Space::Execute && pc >= w.first && pc <= w.last && holds(w.condition, 0))
+            {
+                printf("breakpoint %u at $%04X\n", w.id, pc);
+                clear_break();
+                prompt();
+                return;
+            }
+        }
+
+        if (exec_pages[pc >> 8] & TRAP_BREAK)
+        {
+            if (--steps_left > 0) return;
+            clear_break();
+            prompt();
+        }
+    }
+
+    void on_access(Space space, u16 address, u8 value, bool write)
+    {
+        if (in_prompt) return;
+
+        for (const Watch &w : watches)
+        {
+            if (w.space != space || address < w.first || address > w.last) continue;
+            if (!(write ? w.write : w.read)) continue;
+            if (!holds(w.condition, value)) continue;
+
+            if (write)
+                printf("watchpoint %u: %s write $%02X to $%04X\n", w.id,
+                       space == Space::CPU ? "CPU" : "PPU", value, address);
+            else
+                printf("watchpoint %u: %s read from $%04X\n", w.id,
+                       space == Space::CPU ? "CPU" : "PPU", address);
+            // the access is mid-instruction, so stop once it is done
+            steps_left = 1;
+            request_break();
+            return;
+        }
+    }
+
+    void on_cpu_access(u16 address, u8 value, bool write)
+    {
+        on_access(Space::CPU, address, value, write);
+    }
+
+    void on_ppu_access(u16 address, u8 value, bool write)
+    {
+        on_access(Space::PPU, address, value, write);
+    }
+
+    u32 parse_number(const string &text)
+    {
+        string digits = !text.empty() && text[0] == '$' ? text.substr(1) : text;
+        if (digits.empty() || digits.size() > 8 || digits.find_first_not_of("0123456789abcdefABCDEF") != string::npos)
+            throw std::invalid_argument("not a hex number: " + text);
+        return std::stoul(digits, nullptr, 16);
+    }
+
+    u16 parse_address(const string &text)
+    {
+        u32 address = parse_number(text);
+        if (address > 0xFFFF)
+            throw std::invalid_argument("not an address: " + text);
+        return address;
+    }
+
+    // "c000" or "0300-03ff"
+    void parse_range(const string &text, u16 &first, u16 &last)
+    {
+        size_t dash = text.find('-');
+        first = parse_address(text.substr(0, dash));
+        last = dash == string::npos ? first : parse_address(text.substr(dash + 1));
+        if (last < first)
+            throw std::invalid_argument("empty range: " + text);
+    }
+
+    Condition parse_condition(string text)
+    {
+        Condition c;
+        if (text.empty()) return c;
+        std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+        c.text = text;
+
+        static const vector<std::pair<string, Op>> ops {
+            { "==", Op::Equal }, { "!=", Op::NotEqual }, { "<=", Op::LessEqual },
+            { ">=", Op::GreaterEqual }, { "<", Op::Less }, { ">", Op::Greater }
+        };
+        for (const auto &op : ops)
+        {
+            size_t at = text.find(op.first);
+            if (at == string::npos) continue;
+            c.reg = text.substr(0, at);
+            c.op = op.second;
+            c.value = parse_number(text.substr(at + op.first.size()));
+            break;
+        }
+
+        static const vector<string> regs { "a", "x", "y", "sp", "p", "pc", "value" };
+        if (c.op == Op::Always || std::find(regs.begin(), regs.end(), c.reg) == regs.end())
+            throw std::invalid_argument("expected a condition like a==10 on a, x, y, sp, p, pc or value: " + text);
+        return c;
+    }
+
+    void add(Space space, const string &access, const string &range, const string &condition)
+    {
+        Watch w;
+        w.space = space;
+        w.read = access.find('r') != string::npos;
+        w.write = access.find('w') != string::npos;
+        parse_range(range, w.first, w.last);
+        w.condition = parse_condition(condition);
+        if (space != Space::Execute && !w.read && !w.write)
+            throw std::invalid_argument("expected r, w or rw: " + access);
+        if (space == Space::PPU && w.last >= 0x4000)
+            throw std::invalid_argument("PPU addresses end at $3FFF");
+
+        w.id = next_id++;
+        watches.push_back(w);
+        rebuild_pages();
+        printf("%u\n", w.id);
+    }
+
+    void list()
+    {
+        for (const Watch &w : watches)
+        {
+            const char *space = w.space == Space::Execute ? "break" : w.space == Space::CPU ? "watch" : "pwatch";
+            printf("%3u  %-6s %s%s  $%04X-$%04X", w.id, space,
+                   w.read ? "r" : "", w.write ? "w" : "", w.first, w.last);
+            if (w.condition.op != Op::Always) printf("  if %s", w.condition.text.c_str());
+            printf("\n");
+        }
+    }
+
+    // 16 bytes a line, with -- for bytes that can't be shown
+    template <typename ByteAt>
+    void hexdump(u32 first, u32 count, ByteAt byte_at)
+    {
+        for (u32 line = 0; line < count; line += 16)
+        {
+            printf("%04X ", first + line);
+            for (u32 i = line; i < line + 16 && i < count; i++)
+            {
+                i32 byte = byte_at(first + i);
+                if (byte < 0) printf(" --");
+                else printf(" %02X", byte);
+            }
+            printf("\n");
+        }
+    }
+
+    void help()
+    {
+        printf("step [n]                         run n instructions (s)\n"
+               "continue                         resume (c)\n"
+               "break <addr> [cond]              stop before executing addr (b)\n"
+               "watch r|w|rw <range> [cond]      stop after a CPU bus access (w)\n"
+               "pwatch r|w|rw <range> [cond]     stop after a PPU bus access\n"
+               "delete <id>                      remove a breakpoint or watchpoint (d)\n"
+               "list                             breakpoints and watchpoints (l)\n"
+               "regs                             CPU and PPU state (r)\n"
+               "mem <addr> [count]               CPU memory, except I/O registers (m)\n"
+               "oam                              sprite memory\n"
+               "nt                               nametable memory\n"
+               "quit                             exit the emulator (q)\n"
+               "addresses and values are hex, ranges are first-last, conditions\n"
+               "compare a, x, y, sp, p, pc or a written value, as in x>=10\n");
+    }
+
+    bool command(const string &line)
+    {
+        std::istringstream in(line);
+        string name, arg1, arg2, arg3;
+        in >> name >> arg1 >> arg2 >> arg3;
+
+        if (name.empty()) return true;
+        if (name == "s" || name == "step")
+        {
+            steps_left = arg1.empty() ? 1 : std::stoull(arg1);
+            if (steps_left == 0) return true;
+            request_break();
+            return false;
+        }
+        if (name == "c" || name == "continue") return false;
+        if (name == "q" || name == "quit")
+        {
+            // nothing may stop the machine again on its way out
+            quit_requested = true;
+            watches.clear();
+            rebuild_pages();
+            clear_break();
+            return false;
+        }
+
+        if      (name == "b" || name == "break") add(Space::Execute, "", arg1, arg2);
+        else if (name == "w" || name == "watch") add(Space::CPU, arg1, arg2, arg3);
+        else if (name == "pwatch") add(Space::PPU, arg1, arg2, arg3);
+        else if (name == "d" || name == "delete")
+        {
+            u32 id = std::stoul(arg1);
+            watches.erase(std::remove_if(watches.begin(), watches.end(),
+                                         [id](const Watch &w) { return w.id == id; }),
+                          watches.end());
+            rebuild_pages();
+        }
+        else if (name == "l" || name == "list") list();
+        else if (name == "r" || name == "regs")
+            printf("%s\n", Trace::format(Trace::capture(), Trace::Style::Console).c_str());
+        else if (name == "m" || name == "mem")
+        {
+            u32 first = parse_address(arg1);
+            u32 count = arg2.empty() ? 0x40 : parse_number(arg2);
+            hexdump(first, std::min<u32>(count, 0x10000 - first), [](u32 address) -> i32
+            {
+                // reading PPU and I/O registers has side effects
+                if (address >= 0x2000 && address < 0x6000) return -1;
+                return CPUMemory::read(address);
+            });
+        }
+        else if (name == "oam")
+            hexdump(0, PPU::OAM::data.size(), [](u32 i) -> i32 { return PPU::OAM::data[i]; });
+        else if (name == "nt")
+            hexdump(0, PPU::Nametable::data.size(), [](u32 i) -> i32 { return PPU::Nametable::data[i]; });
+        else help();
+        return true;
+    }
+
+    void prompt()
+    {
+        in_prompt = true;
+        command("regs");
+        char line[256];
+        while (true)
+        {
+            printf("(nes) ");
+            fflush(stdout);
+            if (fgets(line, sizeof(line), stdin) == NULL)
+            {
+                // no more commands: stop debugging and run
+                watches.clear();
+                rebuild_pages();
+                clear_break();
+                break;
+            }
+
+            try
+            {
+                if (!command(line)) break;
+            }
+            catch (const std::exception &e)
+            {
+                printf("%s\n", e.what());
+            }
+        }
+        in_prompt = false;
+    }
+}
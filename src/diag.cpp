@@ -0,0 +1,111 @@
+#include "diag.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+static_assert((Config::DIAG_RING_EVENTS & (Config::DIAG_RING_EVENTS - 1)) == 0,
+              "DIAG_RING_EVENTS must be a power of two");
+
+const array<const char *, static_cast<u32>(Diag::Category::Count)> CATEGORY_NAMES {
+    "cpu", "ppuregs", "ppumemory", "oam", "dma", "mapper", "input"
+};
+
+namespace Diag
+{
+    std::atomic<u32> enabled { 0 };
+
+    /* Each thread writes only its own ring, so recording needs
+       no lock: the writer fills a slot, then publishes it by
+       advancing head. dump() may run on another thread while the
+       writer continues, so it rechecks head after copying and
+       drops the slots that were overwritten in the meantime. */
+    struct Ring
+    {
+        array<Event, Config::DIAG_RING_EVENTS> events;
+        std::atomic<u64> head { 0 };
+    };
+
+    // rings outlive their threads, so that events from a thread
+    // that has exited can still be dumped; the list is only
+    // locked when a thread records its first event
+    std::mutex rings_mutex;
+    vector<Ring *> rings;
+    thread_local Ring *ring = nullptr;
+
+    Ring &thread_ring()
+    {
+        if (ring == nullptr)
+        {
+            ring = new Ring;
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            rings.push_back(ring);
+        }
+        return *ring;
+    }
+
+    void record(Category category, const char *format, u32 a, u32 b)
+    {
+        Ring &r = thread_ring();
+        u64 head = r.head.load(std::memory_order_relaxed);
+        r.events[head & (Config::DIAG_RING_EVENTS - 1)] = { CPU::cycles, format, a, b, category };
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+    void enable(const string &names)
+    {
+        size_t start = 0;
+        while (start <= names.size())
+        {
+            size_t end = std::min(names.find(',', start), names.size());
+            string name = names.substr(start, end - start);
+            start = end + 1;
+
+            if (name == "all")
+            {
+                enabled |= ~0u;
+                continue;
+            }
+
+            auto it = std::find(CATEGORY_NAMES.begin(), CATEGORY_NAMES.end(), name);
+            if (it == CATEGORY_NAMES.end())
+                throw std::invalid_argument("unknown diagnostic category: " + name);
+            enabled |= 1u << (it - CATEGORY_NAMES.begin());
+        }
+    }
+
+    void disable_all()
+    {
+        enabled = 0;
+    }
+
+    void dump(FILE *fp)
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (u32 i = 0; i < rings.size(); i++)
+        {
+            Ring &r = *rings[i];
+            u64 head = r.head.load(std::memory_order_acquire);
+            u64 first = head > Config::DIAG_RING_EVENTS ? head - Config::DIAG_RING_EVENTS : 0;
+            vector<Event> events;
+            for (u64 j = first; j < head; j++)
+                events.push_back(r.events[j & (Config::DIAG_RING_EVENTS - 1)]);
+
+            // the owner may have recorded more meanwhile: event now is
+            // being written over event now - DIAG_RING_EVENTS, and
+            // everything before that is gone
+            u64 now = r.head.load(std::memory_order_acquire);
+            u64 overwritten = now >= Config::DIAG_RING_EVENTS ? now - Config::DIAG_RING_EVENTS + 1 : 0;
+            u64 skip = overwritten > first ? std::min<u64>(overwritten - first, events.size()) : 0;
+
+            fprintf(fp, "[DIAG] thread %u: %lu events, showing %lu\n", i, head, events.size() - skip);
+            for (u64 j = skip; j < events.size(); j++)
+            {
+                const Event &e = events[j];
+                fprintf(fp, "%10lu %-9s ", e.cycle, CATEGORY_NAMES[static_cast<u32>(e.category)]);
+                fprintf(fp, e.format, e.a, e.b);
+                fputc('\n', fp);
+            }
+        }
+    }
+}
@@ -1,12 +1,11 @@
 #include "display.hpp"
 #include "config.hpp"
 #include "crc.hpp"
+#include "ntsc.hpp"
 #include <algorithm>
+#include <cstring>
 #include "SDL2/SDL.h"
 
-const u32 DISPLAY_WIDTH = 256;  // do not change
-const u32 DISPLAY_HEIGHT = 240;
-
 constexpr u32 rgb_to_u32(u8 r, u8 g, u8 b)
 {
     return (r << 16) | (g << 8) | (b << 0);
@@ -32,16 +31,88 @@ constexpr u32 index(u32 u, u32 v)
     return u + v * DISPLAY_WIDTH;
 }
 
+// FNV-1a over the pixels of a scanline, only used to
+// detect which rows changed since the previous frame
+u64 hash_row(const u32 *line)
+{
+    u64 h = 0xCBF29CE484222325;
+    for (u32 i = 0; i < DISPLAY_WIDTH; i++)
+    {
+        h ^= line[i];
+        h *= 0x100000001B3;
+    }
+    return h;
+}
+
 namespace Display
 {
     vector<u32> buffer(DISPLAY_WIDTH * DISPLAY_HEIGHT);
+    vector<u8> colors(DISPLAY_WIDTH * DISPLAY_HEIGHT);
+    array<u8, DISPLAY_HEIGHT> emphasis;
+    vector<u32> ntsc_buffer;
+    u64 frames;
+    array<u64, DISPLAY_HEIGHT> row_hashes;
+    array<bool, DISPLAY_HEIGHT> dirty_rows;
+    array<u32, DISPLAY_HEIGHT> row_frame_hashes; // see frame_hash_part
+    array<bool, DISPLAY_HEIGHT> row_frame_hash_valid;
+    bool frame_dirty;
     SDL_Window *window;
     SDL_Texture *texture;
     SDL_Renderer *renderer;
 
+    u32 *row(u32 v)
+    {
+        return buffer.data() + index(0, v);
+    }
+
+    u8 *color_row(u32 v)
+    {
+        return colors.data() + index(0, v);
+    }
+
+    const u32 *frame()
+    {
+        return buffer.data();
+    }
+
+    const u8 *frame_colors()
+    {
+        return colors.data();
+    }
+
+    void end_row(u32 v, u8 _emphasis)
+    {
+        u64 h = hash_row(row(v));
+        if (h != row_hashes[v] || _emphasis != emphasis[v])
+        {
+            row_hashes[v] = h;
+            emphasis[v] = _emphasis;
+            dirty_rows[v] = true;
+            frame_dirty = true;
+        }
+
+        if (Config::INCREMENTAL_FRAME_HASH)
+        {
+            row_frame_hashes[v] = frame_hash_part(row(v), DISPLAY_WIDTH);
+            row_frame_hash_valid[v] = true;
+        }
+    }
+
+    void invalidate()
+    {
+        std::fill(dirty_rows.begin(), dirty_rows.end(), true);
+        frame_dirty = true;
+    }
+
+    void invalidate_frame_hash()
+    {
+        std::fill(row_frame_hash_valid.begin(), row_frame_hash_valid.end(), false);
+    }
+
     void writePixel(u32 u, u32 v, u32 rgb)
     {
         buffer[index(u, v)] = rgb;
+        row_frame_hash_valid[v] = false;
     }
 
     void writePixel(u32 u, u32 v, u8 r, u8 g, u8 b)
@@ -52,6 +123,8 @@ namespace Display
     void fill(u32 rgb)
     {
         std::fill(buffer.begin(), buffer.end(), rgb);
+        invalidate();
+        invalidate_frame_hash();
     }
 
     void fill(u8 r, u8 g, u8 b)
@@ -64,13 +137,105 @@ namespace Display
         fill(0, 0, 0);
     }
 
-    /* Flip the buffer to the display */
-    void flip()
+    /* Copy rows [first, last) into the streaming texture,
+       scaling them straight into it if a filter is set */
+    void upload_rows(u32 first, u32 last)
     {
-        SDL_UpdateTexture(texture, NULL, buffer.data(), DISPLAY_WIDTH * sizeof(u32));
-        SDL_RenderClear(renderer);
+        const u32 f = Scaler::factor(Config::DISPLAY_FILTER);
+        SDL_Rect rect { 0, static_cast<int>(first * f),
+                        static_cast<int>(DISPLAY_WIDTH * f), static_cast<int>((last - first) * f) };
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(texture, &rect, &pixels, &pitch) < 0)
+            throw std::runtime_error("texture lock fail");
+
+        if (Config::DISPLAY_FILTER == Scaler::Filter::None)
+        {
+            u8 *dst = static_cast<u8 *>(pixels);
+            for (u32 v = first; v < last; v++, dst += pitch)
+                memcpy(dst, row(v), DISPLAY_WIDTH * sizeof(u32));
+        }
+        else
+        {
+            Scaler::scale(Config::DISPLAY_FILTER, buffer.data(), first, last,
+                          pixels, pitch, Config::SCALER_THREADS);
+        }
+
+        SDL_UnlockTexture(texture);
+    }
+
+    /* Run the NTSC filter over the palette indices, on the worker
+       thread if enabled, and upload the whole filtered frame */
+    void flip_ntsc()
+    {
+        const u32 *filtered;
+        if (Config::NTSC_THREADED)
+        {
+            filtered = NTSC::pipeline(colors.data(), emphasis.data(), frames);
+            if (filtered == nullptr) return;
+        }
+        else
+        {
+            NTSC::filter(colors.data(), emphasis.data(), frames, 0, DISPLAY_HEIGHT,
+                         ntsc_buffer.data(), NTSC::OUTPUT_WIDTH * sizeof(u32));
+            filtered = ntsc_buffer.data();
+        }
+
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0)
+            throw std::runtime_error("texture lock fail");
+
+        u8 *dst = static_cast<u8 *>(pixels);
+        for (u32 v = 0; v < DISPLAY_HEIGHT; v++, dst += pitch)
+            memcpy(dst, filtered + v * NTSC::OUTPUT_WIDTH, NTSC::OUTPUT_WIDTH * sizeof(u32));
+
+        SDL_UnlockTexture(texture);
         SDL_RenderCopy(renderer, texture, NULL, NULL);
         SDL_RenderPresent(renderer);
+    }
+
+    /* Flip the buffer to the display, uploading only the
+       scanlines that changed and skipping identical frames */
+    void flip()
+    {
+        frames++;
+
+        if (Config::NTSC_FILTER)
+        {
+            // the colour phase changes every frame, so
+            // unchanged frames still need filtering
+            flip_ntsc();
+            std::fill(dirty_rows.begin(), dirty_rows.end(), false);
+            frame_dirty = false;
+        }
+        else if (frame_dirty)
+        {
+            if (Config::DISPLAY_FILTER != Scaler::Filter::None)
+            {
+                // filters read the rows above and below,
+                // so a changed row changes its neighbours
+                array<bool, DISPLAY_HEIGHT> changed = dirty_rows;
+                for (u32 v = 0; v < DISPLAY_HEIGHT; v++)
+                    dirty_rows[v] = changed[v] ||
+                                    (v > 0 && changed[v - 1]) ||
+                                    (v + 1 < DISPLAY_HEIGHT && changed[v + 1]);
+            }
+
+            u32 v = 0;
+            while (v < DISPLAY_HEIGHT)
+            {
+                if (!dirty_rows[v]) { v++; continue; }
+                u32 first = v;
+                while (v < DISPLAY_HEIGHT && dirty_rows[v]) dirty_rows[v++] = false;
+                upload_rows(first, v);
+            }
+
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+            SDL_RenderPresent(renderer);
+            frame_dirty = false;
+        }
+
         if (Config::PRINT_FRAME_HASH)
         {
             printf("Current frame hash: %08X\n", get_buffer_hash());
@@ -79,6 +244,12 @@ namespace Display
 
     u32 get_buffer_hash()
     {
+        // combining per-scanline hashes costs almost nothing
+        // when every row was hashed as it was drawn
+        if (std::all_of(row_frame_hash_valid.begin(), row_frame_hash_valid.end(),
+                        [](bool valid) { return valid; }))
+            return frame_hash_combine(row_frame_hashes.data(), DISPLAY_HEIGHT, DISPLAY_WIDTH);
+
         return crc32(buffer);
     }
 
@@ -103,20 +274,35 @@ namespace Display
         if (renderer == NULL)
             throw std::runtime_error("renderer init fail");
 
-        texture = SDL_CreateTexture(renderer,
-                                    SDL_PIXELFORMAT_RGB888,
-                                    SDL_TEXTUREACCESS_STREAMING,
-                                    DISPLAY_WIDTH,
-                                    DISPLAY_HEIGHT);
+        if (Config::NTSC_FILTER)
+        {
+            texture = SDL_CreateTexture(renderer,
+                                        SDL_PIXELFORMAT_RGB888,
+                                        SDL_TEXTUREACCESS_STREAMING,
+                                        NTSC::OUTPUT_WIDTH,
+                                        DISPLAY_HEIGHT);
+            ntsc_buffer.resize(NTSC::OUTPUT_WIDTH * DISPLAY_HEIGHT);
+        }
+        else
+        {
+            texture = SDL_CreateTexture(renderer,
+                                        SDL_PIXELFORMAT_RGB888,
+                                        SDL_TEXTUREACCESS_STREAMING,
+                                        DISPLAY_WIDTH * Scaler::factor(Config::DISPLAY_FILTER),
+                                        DISPLAY_HEIGHT * Scaler::factor(Config::DISPLAY_FILTER));
+        }
 
         if (texture == NULL)
             throw std::runtime_error("texture init fail");
 
+        invalidate();
+
         return true;
     }
 
     void deinit()
     {
+        NTSC::stop();
         SDL_DestroyTexture(texture);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
@@ -126,18 +312,28 @@ namespace Display
     void buffer_to_file(const string &file_name)
     {
         FILE *fp = fopen(file_name.c_str(), "wb");
-        fprintf(fp, "P6\n%d %d\n255\n", DISPLAY_WIDTH, DISPLAY_HEIGHT);
-        for (u32 j = 0; j < DISPLAY_HEIGHT; j++)
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        const u32 f = Scaler::factor(Config::VIDEO_FILTER);
+        const u32 width = DISPLAY_WIDTH * f;
+        const u32 height = DISPLAY_HEIGHT * f;
+        vector<u32> scaled(width * height);
+        Scaler::scale(Config::VIDEO_FILTER, buffer.data(), 0, DISPLAY_HEIGHT,
+                      scaled.data(), width * sizeof(u32), Config::SCALER_THREADS);
+
+        fprintf(fp, "P6\n%d %d\n255\n", width, height);
+        vector<u8> line(3 * width);
+        for (u32 j = 0; j < height; j++)
         {
-            for (u32 i = 0; i < DISPLAY_WIDTH; i++)
+            const u32 *src = scaled.data() + j * width;
+            for (u32 i = 0; i < width; i++)
             {
-                static u8 color[3];
-                u32 rgb = buffer[index(i, j)];
-                color[0] = get_r(rgb);
-                color[1] = get_g(rgb);
-                color[2] = get_b(rgb);
-                fwrite(color, 1, 3, fp);
+                line[3 * i + 0] = get_r(src[i]);
+                line[3 * i + 1] = get_g(src[i]);
+                line[3 * i + 2] = get_b(src[i]);
             }
+            fwrite(line.data(), 1, line.size(), fp);
         }
         fclose(fp);
     }
@@ -0,0 +1,82 @@
+#include "gamedb.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace GameDatabase
+{
+    std::once_flag opened;
+    const Entry *entries = NULL;
+    u32 count = 0;
+    const char *names = NULL;
+    u32 names_size = 0;
+    vector<u8> buffer; // where there is no mmap
+
+    // the whole file, or NULL if there is none; it stays mapped for
+    // the life of the process
+    const u8 *map(const string &file_name, size_t &size)
+    {
+#ifdef __unix__
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) return NULL;
+        struct stat info;
+        void *p = fstat(fd, &info) == 0 && info.st_size > 0
+            ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error("could not map " + file_name);
+        size = info.st_size;
+        return static_cast<const u8 *>(p);
+#else
+        FILE *fp = fopen(file_name.c_str(), "rb");
+        if (fp == NULL) return NULL;
+        int c;
+        while ((c = fgetc(fp)) != EOF) buffer.push_back(c);
+        fclose(fp);
+        size = buffer.size();
+        return buffer.data();
+#endif
+    }
+
+    void open()
+    {
+        if (Config::GAME_DATABASE.empty()) return;
+        size_t size = 0;
+        const u8 *file = map(Config::GAME_DATABASE, size);
+        if (file == NULL) return;
+
+        Header header;
+        bool ok = size >= sizeof(header);
+        if (ok) memcpy(&header, file, sizeof(header));
+        ok = ok && memcmp(header.magic, "NESGDB01", 8) == 0
+                && sizeof(header) + static_cast<u64>(header.entries) * sizeof(Entry) + header.names_size == size;
+        if (!ok)
+            throw std::runtime_error(Config::GAME_DATABASE + " is not a game database");
+
+        entries = reinterpret_cast<const Entry *>(file + sizeof(header));
+        count = header.entries;
+        names = reinterpret_cast<const char *>(entries + count);
+        names_size = header.names_size;
+    }
+
+    const Entry *find(u32 crc)
+    {
+        std::call_once(opened, open);
+        const Entry *end = entries + count;
+        const Entry *entry = std::lower_bound(entries, end, crc, [](const Entry &e, u32 c) { return e.crc < c; });
+        return entry != end && entry->crc == crc ? entry : NULL;
+    }
+
+    const char *name(const Entry &entry)
+    {
+        return entry.name < names_size ? names + entry.name : "";
+    }
+}
@@ -0,0 +1,118 @@
+#include "heatmap.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace Heatmap
+{
+    array<Cell, NUM_CELLS> current {};
+
+#ifdef NES_HEATMAP
+
+    FILE *fp = NULL;
+    bool csv = false;
+    u32 bucket_frames = 1;
+    u32 frames_in_bucket = 0;
+    u32 bucket_count = 0;
+    vector<SparseCell> sparse;
+
+    const char *region_name(u32 region)
+    {
+        static const array<const char *, NUM_REGIONS> names {
+            "ram", "nametable", "palette", "oam", "mapper"
+        };
+        return names[region];
+    }
+
+    void write_header()
+    {
+        Header header;
+        memcpy(header.magic, "NESHEAT2", sizeof(header.magic));
+        header.cells = NUM_CELLS;
+        header.frames_per_bucket = bucket_frames;
+        header.bucket_count = bucket_count;
+        header.region_size = REGION_SIZE;
+        fseek(fp, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, fp);
+    }
+
+    void start(const string &file_name, u32 frames_per_bucket)
+    {
+        if (fp != NULL) throw std::runtime_error("heatmap already recording");
+        if (frames_per_bucket == 0)
+            throw std::invalid_argument("a heatmap bucket needs at least one frame");
+        fp = fopen(file_name.c_str(), "wb");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        csv = file_name.size() >= 4 && file_name.compare(file_name.size() - 4, 4, ".csv") == 0;
+        bucket_frames = frames_per_bucket;
+        frames_in_bucket = 0;
+        bucket_count = 0;
+        current.fill(Cell {});
+        if (csv) fprintf(fp, "frame,region,index,reads,writes\n");
+        else write_header();
+    }
+
+    // appends the bucket in current and clears it for the next
+    void write_bucket()
+    {
+        if (csv)
+        {
+            u32 cell = 0;
+            for (u32 r = 0; r < NUM_REGIONS; r++)
+            {
+                for (u32 i = 0; i < REGION_SIZE[r]; i++, cell++)
+                {
+                    const Cell &c = current[cell];
+                    if (c.reads == 0 && c.writes == 0) continue;
+                    fprintf(fp, "%u,%s,%u,%u,%u\n", bucket_count * bucket_frames, region_name(r), i, c.reads, c.writes);
+                }
+            }
+        }
+        else
+        {
+            sparse.clear();
+            for (u32 cell = 0; cell < NUM_CELLS; cell++)
+                if (current[cell].reads != 0 || current[cell].writes != 0)
+                    sparse.push_back({ cell, current[cell].reads, current[cell].writes });
+            u32 count = sparse.size();
+            fwrite(&count, sizeof(count), 1, fp);
+            fwrite(sparse.data(), sizeof(SparseCell), count, fp);
+        }
+        bucket_count++;
+        current.fill(Cell {});
+        frames_in_bucket = 0;
+    }
+
+    void end_frame()
+    {
+        if (fp == NULL || ++frames_in_bucket < bucket_frames) return;
+        write_bucket();
+    }
+
+    void stop()
+    {
+        if (fp == NULL) return;
+        if (frames_in_bucket > 0) write_bucket();
+        if (!csv) write_header(); // now that the bucket count is known
+        fclose(fp);
+        fp = NULL;
+    }
+
+#else
+
+    void start(const string &file_name, u32 frames_per_bucket)
+    {
+        throw std::runtime_error("built without NES_HEATMAP");
+    }
+
+    void end_frame()
+    {
+    }
+
+    void stop()
+    {
+    }
+
+#endif
+}
@@ -1,4 +1,7 @@
 #include "input.hpp"
+#include "diag.hpp"
+#include "movie.hpp"
+#include "savestate.hpp"
 #include <algorithm>
 
 namespace Input 
@@ -19,15 +22,26 @@ namespace Input
 
     }
 
+    u8 Controller::value()
+    {
+        u8 value = 0;
+        for (u32 i = 0; i < 8; i++) value |= buttons[i] << i;
+        return value;
+    }
+
     u8 Controller::read()
     {
-        return buttons[polling ? (index = 0) : (index++)];
+        if (polling) index = 0;
+        // a standard controller reads as 1 after its 8 buttons
+        if (index >= 8) return 1;
+        return buttons[polling ? index : index++];
     }
 
     void Controller::write(u8 value)
     {
         polling = value & 1;
         index = 0;
+        Diag::event<Diag::Category::Input>("[INPUT] Wrote strobe %u", polling);
     }
 
     void Controller::setButton(u32 buttonIndex, bool down)
@@ -35,11 +49,27 @@ namespace Input
         buttons[buttonIndex] = down;
     }
 
+    void Controller::setButtons(u8 value)
+    {
+        for (u32 i = 0; i < 8; i++) buttons[i] = (value >> i) & 1;
+    }
+
+    void Controller::serialize(SaveState::Stream &s)
+    {
+        u8 held = value();
+        s.field(held);
+        setButtons(held);
+        s.field(index);
+        s.field(polling);
+    }
+
     void handle_event(const SDL_Event &event)
     {
         bool down = event.type == SDL_KEYDOWN;
         if (!down && event.type != SDL_KEYUP)
             throw std::invalid_argument("unknown event type");
+        // a movie being played owns the controllers
+        if (Movie::playing()) return;
 
         SDL_Keycode key_pressed = event.key.keysym.sym;
 
@@ -0,0 +1,234 @@
+#include "keyframes.hpp"
+#include "savestate.hpp"
+#include "cartridge.hpp"
+#include <cstring>
+#include <stdexcept>
+#ifdef __unix__
+#include <sys/mman.h>
+#endif
+
+// unchanged bytes shorter than this stay inside a run of changed ones
+const size_t MIN_SKIP = 8;
+
+namespace Keyframes
+{
+    struct Entry
+    {
+        u64 offset; // of the payload in the file
+        u32 size;
+        bool full;
+    };
+
+    FILE *file = NULL;
+    Header header;
+    vector<Entry> entries;
+    u64 file_size = 0;
+    vector<u8> last; // keyframe count() - 1, what the next one is encoded against
+
+    const u8 *mapped = NULL;
+    u64 mapped_size = 0;
+    vector<u8> read_buffer; // where there is no mmap
+
+    void unmap()
+    {
+#ifdef __unix__
+        if (mapped != NULL) munmap(const_cast<u8 *>(mapped), mapped_size);
+#endif
+        mapped = NULL;
+        mapped_size = 0;
+    }
+
+    const u8 *payload(const Entry &e)
+    {
+#ifdef __unix__
+        if (e.offset + e.size > mapped_size)
+        {
+            // grown since it was mapped
+            unmap();
+            fflush(file);
+            void *p = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+            if (p == MAP_FAILED)
+                throw std::runtime_error("could not map the keyframe index");
+            mapped = static_cast<const u8 *>(p);
+            mapped_size = file_size;
+        }
+        return mapped + e.offset;
+#else
+        read_buffer.resize(e.size);
+        fseek(file, e.offset, SEEK_SET);
+        if (fread(read_buffer.data(), 1, e.size, file) != e.size)
+            throw std::runtime_error("could not read the keyframe index");
+        fseek(file, 0, SEEK_END);
+        return read_buffer.data();
+#endif
+    }
+
+    void encode(const vector<u8> &state, const vector<u8> &previous, vector<u8> &out)
+    {
+        auto put = [&out](u32 value)
+        {
+            const u8 *p = reinterpret_cast<const u8 *>(&value);
+            out.insert(out.end(), p, p + sizeof(value));
+        };
+
+        size_t n = state.size();
+        size_t i = 0;
+        while (i < n)
+        {
+            size_t start = i;
+            while (i < n && state[i] == previous[i]) i++;
+            if (i == n) break;
+            size_t changed = i;
+
+            // extend over short stretches of unchanged bytes
+            while (i < n)
+            {
+                if (state[i] != previous[i]) { i++; continue; }
+                size_t same = i;
+                while (same < n && same - i < MIN_SKIP && state[same] == previous[same]) same++;
+                if (same - i == MIN_SKIP || same == n) break;
+                i = same;
+            }
+
+            put(changed - start);
+            put(i - changed);
+            out.insert(out.end(), state.begin() + changed, state.begin() + i);
+        }
+    }
+
+    void apply_delta(const u8 *delta, u32 size, vector<u8> &state)
+    {
+        const u8 *end = delta + size;
+        size_t position = 0;
+        while (delta < end)
+        {
+            u32 skip, changed;
+            memcpy(&skip, delta, sizeof(u32));
+            memcpy(&changed, delta + sizeof(u32), sizeof(u32));
+            delta += 2 * sizeof(u32);
+            position += skip;
+            if (position + changed > state.size() || delta + changed > end)
+                throw std::runtime_error("corrupt keyframe index");
+            memcpy(state.data() + position, delta, changed);
+            delta += changed;
+            position += changed;
+        }
+    }
+
+    void decode(u64 n, vector<u8> &state)
+    {
+        u64 base = n - n % FULL_EVERY;
+        const u8 *full = payload(entries[base]);
+        state.assign(full, full + entries[base].size);
+        for (u64 i = base + 1; i <= n; i++)
+            apply_delta(payload(entries[i]), entries[i].size, state);
+    }
+
+    // the records of an existing index, dropping a torn one at the end
+    void scan()
+    {
+        u64 offset = sizeof(Header);
+        Record record;
+        while (fseek(file, offset, SEEK_SET) == 0 && fread(&record, sizeof(record), 1, file) == 1)
+        {
+            u64 end = offset + sizeof(record) + record.size;
+            if (end > file_size || (record.full != 0) != (entries.size() % FULL_EVERY == 0))
+                break;
+            entries.push_back({ offset + sizeof(record), record.size, record.full != 0 });
+            offset = end;
+        }
+        file_size = offset;
+    }
+
+    void open(const string &file_name, u32 movie_crc, u32 frames_between)
+    {
+        close();
+
+        Header expected;
+        memcpy(expected.magic, "NESKEYS1", sizeof(expected.magic));
+        expected.rom_crc = Cartridge::crc;
+        expected.movie_crc = movie_crc;
+        expected.interval = frames_between;
+        expected.state_size = SaveState::save().size();
+
+        file = fopen(file_name.c_str(), "r+b");
+        if (file != NULL)
+        {
+            fseek(file, 0, SEEK_END);
+            file_size = ftell(file);
+            fseek(file, 0, SEEK_SET);
+            if (fread(&header, sizeof(header), 1, file) == 1 && memcmp(&header, &expected, sizeof(header)) == 0)
+                scan();
+            else
+            {
+                fclose(file);
+                file = NULL;
+            }
+        }
+        if (file == NULL)
+        {
+            file = fopen(file_name.c_str(), "w+b");
+            if (file == NULL)
+                throw std::runtime_error("could not open " + file_name);
+            header = expected;
+            fwrite(&header, sizeof(header), 1, file);
+            file_size = sizeof(header);
+        }
+
+        // appends go after the last whole record
+        fflush(file);
+        fseek(file, file_size, SEEK_SET);
+        if (!entries.empty()) decode(entries.size() - 1, last);
+    }
+
+    void close()
+    {
+        unmap();
+        if (file != NULL) fclose(file);
+        file = NULL;
+        entries.clear();
+        last.clear();
+        file_size = 0;
+    }
+
+    bool active()
+    {
+        return file != NULL;
+    }
+
+    u32 interval()
+    {
+        return header.interval;
+    }
+
+    u64 count()
+    {
+        return entries.size();
+    }
+
+    void add()
+    {
+        vector<u8> state = SaveState::save();
+        bool full = entries.size() % FULL_EVERY == 0;
+        vector<u8> delta;
+        if (!full) encode(state, last, delta);
+        const vector<u8> &data = full ? state : delta;
+
+        Record record { static_cast<u32>(data.size()), full };
+        fseek(file, file_size, SEEK_SET);
+        fwrite(&record, sizeof(record), 1, file);
+        fwrite(data.data(), 1, data.size(), file);
+        entries.push_back({ file_size + sizeof(record), record.size, full });
+        file_size += sizeof(record) + data.size();
+        last = std::move(state);
+    }
+
+    void restore(u64 n)
+    {
+        if (n >= entries.size())
+            throw std::out_of_range("no keyframe " + std::to_string(n));
+        vector<u8> state;
+        decode(n, state);
+        SaveState::load(state);
+    }
+}
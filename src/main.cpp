@@ -3,20 +3,137 @@
 #include "console.hpp"
 #include "cpu.hpp"
 #include "mapper.hpp"
+#include "videoexport.hpp"
+#include "trace.hpp"
+#include "profiler.hpp"
+#include "diag.hpp"
+#include "metrics.hpp"
+#include "timeline.hpp"
+#include "perfcounters.hpp"
+#include "debugger.hpp"
+#include "codedatalog.hpp"
+#include "heatmap.hpp"
+#include "movie.hpp"
+#include "config.hpp"
 #include "SDL2/SDL.h"
 
 const u64 CPU_CYCLES_MAX = static_cast<u64>(1) << 50;
 
+// parses "first-last", either of which may be left out
+template <typename T>
+void parse_range(const string &arg, T &first, T &last, int base)
+{
+    size_t dash = arg.find('-');
+    if (dash == string::npos)
+        throw std::invalid_argument("expected a range like first-last: " + arg);
+    if (dash > 0) first = std::stoull(arg.substr(0, dash), nullptr, base);
+    if (dash + 1 < arg.size()) last = std::stoull(arg.substr(dash + 1), nullptr, base);
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc < 2) 
+    string rom_name;
+    string video_name;
+    string trace_name;
+    string profile_name;
+    string metrics_name;
+    string timeline_name;
+    string perf_name;
+    string cdl_name;
+    string heatmap_name;
+    string record_name;
+    string play_name;
+    u64 seek_frame = 0;
+    Trace::Triggers triggers;
+    for (int i = 1; i < argc; i++)
     {
-        printf("\n\tUsage: %s <romname>.nes\n", argv[0]);
+        string arg = argv[i];
+        if (arg == "--video" && i + 1 < argc) video_name = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc) trace_name = argv[++i];
+        else if (arg == "--profile" && i + 1 < argc) profile_name = argv[++i];
+        else if (arg == "--diag" && i + 1 < argc) Diag::enable(argv[++i]);
+        else if (arg == "--metrics" && i + 1 < argc) metrics_name = argv[++i];
+        else if (arg == "--timeline" && i + 1 < argc) timeline_name = argv[++i];
+        else if (arg == "--perf" && i + 1 < argc) perf_name = argv[++i];
+        else if (arg == "--debug") Debugger::request_break();
+        else if (arg == "--cdl" && i + 1 < argc) cdl_name = argv[++i];
+        else if (arg == "--heatmap" && i + 1 < argc) heatmap_name = argv[++i];
+        else if (arg == "--record" && i + 1 < argc) record_name = argv[++i];
+        else if (arg == "--play" && i + 1 < argc) play_name = argv[++i];
+        else if (arg == "--seek" && i + 1 < argc) seek_frame = std::stoull(argv[++i]);
+        else if (arg == "--trace-pc" && i + 1 < argc)
+            parse_range(argv[++i], triggers.pc_first, triggers.pc_last, 16);
+        else if (arg == "--trace-frames" && i + 1 < argc)
+            parse_range(argv[++i], triggers.frame_first, triggers.frame_last, 10);
+        else if (arg == "--trace-cycles" && i + 1 < argc)
+            parse_range(argv[++i], triggers.cycle_first, triggers.cycle_last, 10);
+        else rom_name = arg;
+    }
+
+    if (rom_name.empty()) 
+    {
+        printf("\n\tUsage: %s <romname>.nes [--video <file>.y4m|.rgb|.idx]\n"
+               "\t\t[--trace <file> [--trace-pc XXXX-XXXX] [--trace-frames a-b] [--trace-cycles a-b]]\n"
+               "\t\t[--profile <name>, writes <name>.folded and <name>.txt]\n"
+               "\t\t[--diag cpu,ppuregs,ppumemory,oam,dma,mapper,input|all, dumped on exit]\n"
+               "\t\t[--metrics <file>|-, JSON lines when the file ends in .json]\n"
+               "\t\t[--timeline <file>.json, trace-event spans written on exit]\n"
+               "\t\t[--perf <file>.csv, hardware counters per frame and phase]\n"
+               "\t\t[--debug, stop at the first instruction in a command prompt]\n"
+               "\t\t[--cdl <file>.cdl, code/data log merged and saved on exit, with <file>.cdl.txt]\n"
+               "\t\t[--heatmap <file>.csv|.bin, accesses per address and frame, needs make HEATMAP=1]\n"
+               "\t\t[--record <file>, input movie from power on, R presses reset]\n"
+               "\t\t[--play <file> [--seek <frame>], replay a movie, then hand over to the keyboard]\n", argv[0]);
         exit(1);
     }
 
-    Console::init(argv[1]);
+    Console::init(rom_name);
+    if (!cdl_name.empty())
+    {
+        // carry on from an earlier session's log
+        FILE *existing = fopen(cdl_name.c_str(), "rb");
+        if (existing != NULL)
+        {
+            fclose(existing);
+            CodeDataLog::load(cdl_name);
+        }
+    }
+    if (!record_name.empty())
+        Movie::record(record_name);
+    if (!play_name.empty())
+        Movie::play(play_name);
+    if (seek_frame > 0)
+        Movie::seek(seek_frame);
+    if (!video_name.empty())
+        VideoExport::start(video_name, VideoExport::format_for(video_name));
+    if (!trace_name.empty())
+        Trace::start_file(trace_name, Config::TRACE_RING_RECORDS, triggers);
+    if (!profile_name.empty())
+        Profiler::start();
+    if (!timeline_name.empty())
+        Timeline::start(timeline_name, Config::TIMELINE_SPANS);
+    if (!perf_name.empty())
+        PerfCounters::start(perf_name);
+    if (!heatmap_name.empty())
+        Heatmap::start(heatmap_name, Config::HEATMAP_FRAMES_PER_BUCKET);
+    if (!metrics_name.empty())
+    {
+        bool json = metrics_name.size() >= 5 && metrics_name.compare(metrics_name.size() - 5, 5, ".json") == 0;
+        Metrics::start_dump(metrics_name, json, Config::METRICS_DUMP_INTERVAL);
+    }
     Console::run();
+    if (Profiler::active())
+    {
+        Profiler::stop();
+        Profiler::save_folded(profile_name + ".folded");
+        Profiler::save_hotspots(profile_name + ".txt");
+    }
     Console::deinit();
+    if (!cdl_name.empty())
+    {
+        CodeDataLog::save(cdl_name);
+        CodeDataLog::save_summary(cdl_name + ".txt");
+    }
+    if (Diag::enabled) Diag::dump(stderr);
     return 0;
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #include <memory>
 #include <cassert>
+#include <stdexcept>
 #include "mapper.hpp"
 #include "console.hpp"
 #include "cartridge.hpp"
+#include "diag.hpp"
+#include "codedatalog.hpp"
+#include "savestate.hpp"
 
 Mapper::Mapper()
 {
@@ -28,7 +32,8 @@ std::unique_ptr<Mapper> Mapper::generateMapper()
 
 Mapper2::Mapper2()
 {
-    prgBanks = Cartridge::prg.size() / 0x4000;
+    prgBanks = Cartridge::image->prg_size / 0x4000;
+    if (prgBanks == 0) throw std::invalid_argument("PRG-ROM is smaller than a bank");
     prgBank1 = 0;
     prgBank2 = prgBanks - 1;
 }
@@ -39,10 +44,23 @@ Mapper2::~Mapper2()
 
 u8 Mapper2::read(u16 addr)
 {
-    if (addr  < 0x2000) return Cartridge::chr[addr];
-    if (addr >= 0xC000) return Cartridge::prg[(prgBank2 * 0x4000 + addr) - 0xC000];
-    if (addr >= 0x8000) return Cartridge::prg[(prgBank1 * 0x4000 + addr) - 0x8000];
-    if (addr >= 0x6000) return Cartridge::sram[addr - 0x6000];
+    if (addr < 0x2000)
+    {
+        CodeDataLog::chr_access(addr);
+        return Cartridge::chr[addr];
+    }
+    if (addr >= 0x8000)
+    {
+        u32 offset = (addr >= 0xC000 ? prgBank2 : prgBank1) * 0x4000 + (addr & 0x3FFF);
+        CodeDataLog::prg_access(offset);
+        return Cartridge::prg[offset];
+    }
+    if (addr >= 0x6000)
+    {
+        // open bus without PRG-RAM, mirrored when it's under 8KB
+        if (Cartridge::sram.empty()) return 0;
+        return Cartridge::sram[(addr - 0x6000) % Cartridge::sram.size()];
+    }
 
     throw "Invalid Mapper2 read";
     return 0;
@@ -50,13 +68,37 @@ u8 Mapper2::read(u16 addr)
 
 void Mapper2::write(u16 addr, u8 value)
 {
-    if      (addr  < 0x2000) Cartridge::chr[addr] = value;
-    else if (addr >= 0x8000) prgBank1 = value % prgBanks;
-    else if (addr >= 0x6000) Cartridge::sram[addr - 0x6000] = value;
+    if      (addr  < 0x2000)
+    {
+        if (Cartridge::chr_ram) Cartridge::chr_ram_data[addr] = value;
+    }
+    else if (addr >= 0x8000)
+    {
+        prgBank1 = value % prgBanks;
+        Diag::event<Diag::Category::Mapper>("[MAPPER] Selected PRG bank %u at 0x8000", prgBank1);
+    }
+    else if (addr >= 0x6000)
+    {
+        if (!Cartridge::sram.empty()) Cartridge::sram[(addr - 0x6000) % Cartridge::sram.size()] = value;
+    }
     else throw "Invalid Mapper2 write";
 }
 
+u16 Mapper2::read_pattern(u16 addr)
+{
+    CodeDataLog::chr_access(addr);
+    CodeDataLog::chr_access(addr + 8);
+    if (Cartridge::chr_ram) return Cartridge::pattern_row(Cartridge::chr[addr], Cartridge::chr[addr + 8]);
+    return Cartridge::tiles[Cartridge::tile_row(addr)];
+}
+
 void Mapper2::step()
 {
 
+}
+
+void Mapper2::serialize(SaveState::Stream &s)
+{
+    s.field(prgBank1);
+    s.field(prgBank2);
 }
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "metrics.hpp"
+#include <mutex>
+#include <stdexcept>
+
+namespace Metrics
+{
+    // blocks outlive their threads, so totals keep counting
+    // the work of threads that have exited
+    std::mutex blocks_mutex;
+    vector<Block *> blocks;
+    thread_local Block *block = nullptr;
+
+    Block &register_thread()
+    {
+        block = new Block;
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        blocks.push_back(block);
+        return *block;
+    }
+
+    u64 get(Counter counter)
+    {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        u64 total = 0;
+        for (const Block *b : blocks)
+            total += b->values[static_cast<u32>(counter)].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    Snapshot snapshot()
+    {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        Snapshot totals {};
+        for (const Block *b : blocks)
+            for (u32 i = 0; i < NUM_COUNTERS; i++)
+                totals[i] += b->values[i].load(std::memory_order_relaxed);
+        return totals;
+    }
+
+    const char *name(Counter counter)
+    {
+        static const array<const char *, NUM_COUNTERS> names {
+            "instructions", "cpu_cycles", "dma_stall_cycles", "ppu_dots", "frames",
+            "reads_2000", "reads_2001", "reads_2002", "reads_2003",
+            "reads_2004", "reads_2005", "reads_2006", "reads_2007",
+            "writes_2000", "writes_2001", "writes_2002", "writes_2003",
+            "writes_2004", "writes_2005", "writes_2006", "writes_2007",
+            "oam_dma_transfers",
+            "host_step_ns", "host_render_ns", "host_flip_ns", "host_events_ns"
+        };
+        return names[static_cast<u32>(counter)];
+    }
+
+    // Console::step time not spent rendering or flipping
+    u64 host_cpu_ns(const Snapshot &s)
+    {
+        u64 step = s[static_cast<u32>(Counter::HostStepNs)];
+        u64 nested = s[static_cast<u32>(Counter::HostRenderNs)] + s[static_cast<u32>(Counter::HostFlipNs)];
+        return step > nested ? step - nested : 0;
+    }
+
+    double rate(const Snapshot &current, const Snapshot *previous, double seconds, u32 i)
+    {
+        return (current[i] - (*previous)[i]) / seconds;
+    }
+
+    string to_text(const Snapshot &current, const Snapshot *previous, double seconds)
+    {
+        bool rates = previous != nullptr && seconds > 0;
+        string out;
+        char line[96];
+        for (u32 i = 0; i < NUM_COUNTERS; i++)
+        {
+            if (rates)
+                snprintf(line, sizeof(line), "%-18s %16lu %16.1f/s\n",
+                         name(static_cast<Counter>(i)), current[i], rate(current, previous, seconds, i));
+            else
+                snprintf(line, sizeof(line), "%-18s %16lu\n", name(static_cast<Counter>(i)), current[i]);
+            out += line;
+        }
+        snprintf(line, sizeof(line), "%-18s %16lu\n", "host_cpu_ns", host_cpu_ns(current));
+        out += line;
+        return out;
+    }
+
+    string to_json(const Snapshot &current, const Snapshot *previous, double seconds)
+    {
+        bool rates = previous != nullptr && seconds > 0;
+        string out = "{";
+        char field[96];
+        for (u32 i = 0; i < NUM_COUNTERS; i++)
+        {
+            snprintf(field, sizeof(field), "\"%s\":%lu,", name(static_cast<Counter>(i)), current[i]);
+            out += field;
+        }
+        snprintf(field, sizeof(field), "\"host_cpu_ns\":%lu", host_cpu_ns(current));
+        out += field;
+
+        if (rates)
+        {
+            out += ",\"per_second\":{";
+            for (u32 i = 0; i < NUM_COUNTERS; i++)
+            {
+                snprintf(field, sizeof(field), "%s\"%s\":%.1f", i > 0 ? "," : "",
+                         name(static_cast<Counter>(i)), rate(current, previous, seconds, i));
+                out += field;
+            }
+            out += "}";
+        }
+        return out + "}";
+    }
+
+    FILE *dump_file = nullptr;
+    bool dump_json;
+    double dump_interval;
+    Snapshot last_dump;
+    std::chrono::steady_clock::time_point last_dump_time;
+
+    void start_dump(const string &file_name, bool json, double interval_seconds)
+    {
+        stop_dump();
+        dump_file = file_name == "-" ? stdout : fopen(file_name.c_str(), "w");
+        if (dump_file == nullptr)
+            throw std::runtime_error("could not open " + file_name);
+
+        dump_json = json;
+        dump_interval = interval_seconds;
+        last_dump = snapshot();
+        last_dump_time = std::chrono::steady_clock::now();
+    }
+
+    void poll_dump()
+    {
+        if (dump_file == nullptr) return;
+
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - last_dump_time).count();
+        if (seconds < dump_interval) return;
+
+        Snapshot current = snapshot();
+        if (dump_json)
+            fprintf(dump_file, "%s\n", to_json(current, &last_dump, seconds).c_str());
+        else
+            fprintf(dump_file, "[METRICS]\n%s\n", to_text(current, &last_dump, seconds).c_str());
+        fflush(dump_file);
+
+        last_dump = current;
+        last_dump_time = now;
+    }
+
+    void stop_dump()
+    {
+        if (dump_file == nullptr) return;
+        if (dump_file != stdout) fclose(dump_file);
+        dump_file = nullptr;
+    }
+}
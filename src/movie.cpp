@@ -0,0 +1,193 @@
+#include "movie.hpp"
+#include "cartridge.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "input.hpp"
+#include "display.hpp"
+#include "console.hpp"
+#include "keyframes.hpp"
+#include "crc.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace Movie
+{
+    Mode mode = Mode::Off;
+    bool keyframe_due = false;
+    string recording_name;
+    vector<u16> inputs; // controller1 | controller2 << 8, per frame
+    vector<u32> resets;
+    u32 next_reset = 0;
+
+    u16 sample()
+    {
+        return Input::controller1.value() | Input::controller2.value() << 8;
+    }
+
+    // set the controllers and press reset for the frame starting now
+    void apply(u64 frame)
+    {
+        Input::controller1.setButtons(inputs[frame] & 0xFF);
+        Input::controller2.setButtons(inputs[frame] >> 8);
+        while (next_reset < resets.size() && resets[next_reset] == frame)
+        {
+            CPU::trigger_reset();
+            next_reset++;
+        }
+    }
+
+    void record(const string &file_name)
+    {
+        if (PPU::frame_count != 0)
+            throw std::logic_error("movies are recorded from power on");
+        recording_name = file_name;
+        inputs.clear();
+        resets.clear();
+        mode = Mode::Recording;
+    }
+
+    void load(const string &file_name)
+    {
+        FILE *fp = fopen(file_name.c_str(), "rb");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        Header header;
+        bool ok = fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, "NESMOVI1", 8) == 0;
+        resets.resize(ok ? header.resets : 0);
+        vector<Run> runs(ok ? header.runs : 0);
+        ok = ok && fread(resets.data(), sizeof(u32), resets.size(), fp) == resets.size()
+                && fread(runs.data(), sizeof(Run), runs.size(), fp) == runs.size();
+        fclose(fp);
+        if (!ok)
+            throw std::runtime_error(file_name + " is not a movie");
+
+        if (header.rom_crc != Cartridge::crc)
+        {
+            char message[96];
+            snprintf(message, sizeof(message), "movie was recorded on ROM %08X, this is %08X",
+                     header.rom_crc, Cartridge::crc);
+            throw std::runtime_error(message);
+        }
+
+        inputs.clear();
+        for (const Run &run : runs)
+            inputs.insert(inputs.end(), run.frames, run.controller1 | run.controller2 << 8);
+        if (inputs.size() != header.frames)
+            throw std::runtime_error(file_name + " is truncated");
+    }
+
+    void play(const string &file_name)
+    {
+        if (PPU::frame_count != 0)
+            throw std::logic_error("movies are played from power on");
+        load(file_name);
+        next_reset = 0;
+        if (inputs.empty()) return;
+
+        if (Config::MOVIE_KEYFRAME_INTERVAL > 0)
+        {
+            u32 movie_crc = crc32(reinterpret_cast<const u8 *>(inputs.data()), inputs.size() * sizeof(u16));
+            movie_crc = crc32(reinterpret_cast<const u8 *>(resets.data()), resets.size() * sizeof(u32), movie_crc);
+            Keyframes::open(file_name + ".keys", movie_crc, Config::MOVIE_KEYFRAME_INTERVAL);
+            if (Keyframes::count() == 0) Keyframes::add(); // power on
+        }
+        mode = Mode::Playing;
+        apply(0);
+    }
+
+    void add_keyframe()
+    {
+        keyframe_due = false;
+        Keyframes::add();
+    }
+
+    void seek(u64 frame)
+    {
+        if (!Keyframes::active())
+            throw std::logic_error("seeking needs a movie played with keyframes");
+        if (frame > inputs.size())
+            throw std::out_of_range("the movie has " + std::to_string(inputs.size()) + " frames");
+
+        // the keyframe before the frame, so at least one whole frame
+        // is drawn on the way
+        u64 interval = Keyframes::interval();
+        u64 keyframe = std::min(frame == 0 ? 0 : (frame - 1) / interval, Keyframes::count() - 1);
+        u64 start = keyframe * interval;
+        Keyframes::restore(keyframe);
+
+        keyframe_due = false;
+        next_reset = std::lower_bound(resets.begin(), resets.end(), start) - resets.begin();
+        mode = Mode::Playing;
+        apply(start);
+        while (PPU::frame_count < frame) Console::execute();
+    }
+
+    void save(const string &file_name)
+    {
+        vector<Run> runs;
+        for (u16 input : inputs)
+        {
+            if (runs.empty() || runs.back().frames == UINT16_MAX ||
+                (runs.back().controller1 | runs.back().controller2 << 8) != input)
+                runs.push_back({ 0, static_cast<u8>(input & 0xFF), static_cast<u8>(input >> 8) });
+            runs.back().frames++;
+        }
+
+        FILE *fp = fopen(file_name.c_str(), "wb");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        Header header;
+        memcpy(header.magic, "NESMOVI1", sizeof(header.magic));
+        header.rom_crc = Cartridge::crc;
+        header.frames = inputs.size();
+        header.resets = resets.size();
+        header.runs = runs.size();
+        fwrite(&header, sizeof(header), 1, fp);
+        fwrite(resets.data(), sizeof(u32), resets.size(), fp);
+        fwrite(runs.data(), sizeof(Run), runs.size(), fp);
+        fclose(fp);
+    }
+
+    void end_frame()
+    {
+        if (mode == Mode::Recording)
+        {
+            // the input the frame that just ended ran with
+            inputs.push_back(sample());
+            return;
+        }
+
+        if (PPU::frame_count < inputs.size())
+        {
+            apply(PPU::frame_count);
+            if (Keyframes::active() && PPU::frame_count == Keyframes::count() * Keyframes::interval())
+                keyframe_due = true;
+            return;
+        }
+        printf("[MOVIE] Playback ended after %lu frames, frame hash %08X\n",
+               inputs.size(), Display::get_buffer_hash());
+        mode = Mode::Off;
+    }
+
+    void stop()
+    {
+        if (mode == Mode::Recording) save(recording_name);
+        mode = Mode::Off;
+        keyframe_due = false;
+        Keyframes::close();
+    }
+
+    void reset()
+    {
+        if (mode == Mode::Recording) resets.push_back(PPU::frame_count);
+    }
+
+    u64 length()
+    {
+        return inputs.size();
+    }
+}
@@ -0,0 +1,335 @@
+#include "ntsc.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NTSC_HAVE_X86 1
+#endif
+
+/* The PPU outputs 8 samples of a square wave per pixel, at
+   six times the colour subcarrier frequency: one subcarrier
+   cycle is 12 samples, so a pixel starts on phase 0, 4 or 8.
+   The decoder output is linear in the signal, so for every
+   palette entry and starting phase we precompute how much the
+   pixel adds to the RGB of each output pixel it reaches, and
+   filtering a row is a sum of a few kernel rows per output. */
+const u32 SAMPLES_PER_PIXEL = 8;
+const u32 PHASES = 12;
+const u32 PIXEL_PHASES = 3;
+const u32 REACH = 2;                 // a pixel reaches output pairs n - 2 .. n + 2
+const u32 TAPS = 2 * REACH + 1;
+const u32 LANES = 8;                 // one output pair: B G R 0 B G R 0
+const u32 ENTRIES = 64 * 8 + 1;      // palette index | emphasis << 6, and the border
+const u32 BORDER = 64 * 8;
+const i32 FRACTION_BITS = 8;
+
+// decoder settings
+const double HUE = 4;                // in samples, 30 degrees each
+const double SATURATION = 0.8;
+const double BRIGHTNESS = 1.0;
+const double LUMA_WIDTH = 6;         // half width of the luma box filter, in samples
+const double CHROMA_WIDTH = 12;      // half width of the chroma triangle filter
+
+namespace NTSC
+{
+    alignas(32) i32 kernels[ENTRIES][PIXEL_PHASES][TAPS][LANES];
+
+    // composite level of a sample, 0 for black and 1 for white
+    double signal(u32 entry, u32 phase)
+    {
+        // relative to sync, from the nesdev wiki's measurements
+        const double levels[8] = { 0.228, 0.312, 0.552, 0.880,    // low
+                                   0.616, 0.840, 1.100, 1.100 };  // high
+        const double black = 0.312, white = 1.100;
+        const double attenuation = 0.746;
+
+        u32 color = entry & 0x0F;
+        u32 level = (entry >> 4) & 0b11;
+        u32 emphasis = entry >> 6;
+        if (color > 13) level = 1;
+
+        double low = levels[level];
+        double high = levels[4 + level];
+        if (color == 0) low = high;
+        if (color > 12) high = low;
+
+        auto in_phase = [phase](u32 c) { return (c + phase) % PHASES < 6; };
+        double s = in_phase(color) ? high : low;
+        if (((emphasis & 0b001) && in_phase(0)) ||
+            ((emphasis & 0b010) && in_phase(4)) ||
+            ((emphasis & 0b100) && in_phase(8)))
+            s *= attenuation;
+
+        return (s - black) / (white - black);
+    }
+
+    void build_kernels()
+    {
+        const double scale = 255.0 * (1 << FRACTION_BITS) * BRIGHTNESS;
+        const double pi = std::acos(-1.0);
+
+        for (u32 entry = 0; entry < ENTRIES; entry++)
+        for (u32 p = 0; p < PIXEL_PHASES; p++)
+        for (u32 t = 0; t < TAPS; t++)
+        for (u32 q = 0; q < 2; q++)
+        {
+            // output 2 * (n + t - REACH) + q is centered on sample
+            // 4 * that + 2, counted from the start of pixel n
+            double center = 4.0 * (2.0 * (static_cast<i32>(t) - static_cast<i32>(REACH)) + q) + 2;
+            double y = 0, i = 0, q_ = 0;
+            if (entry != BORDER)
+            {
+                for (u32 j = 0; j < SAMPLES_PER_PIXEL; j++)
+                {
+                    u32 phase = (4 * p + j) % PHASES;
+                    double s = signal(entry, phase);
+                    double distance = std::abs(j + 0.5 - center);
+                    if (distance < LUMA_WIDTH)
+                        y += s / (2 * LUMA_WIDTH);
+                    if (distance < CHROMA_WIDTH)
+                    {
+                        double w = (CHROMA_WIDTH - distance) / (CHROMA_WIDTH * CHROMA_WIDTH);
+                        double angle = 2 * pi * (phase + HUE) / PHASES;
+                        i += 2 * SATURATION * w * s * std::cos(angle);
+                        q_ += 2 * SATURATION * w * s * std::sin(angle);
+                    }
+                }
+            }
+
+            double r = y + 0.946882 * i + 0.623557 * q_;
+            double g = y - 0.274788 * i - 0.635691 * q_;
+            double b = y - 1.108545 * i + 1.709007 * q_;
+
+            i32 *lanes = kernels[entry][p][t] + 4 * q;
+            lanes[0] = std::lround(b * scale);
+            lanes[1] = std::lround(g * scale);
+            lanes[2] = std::lround(r * scale);
+            lanes[3] = 0;
+
+            // every output sums exactly one centre tap, which
+            // carries the rounding for the final shift
+            if (t == REACH)
+                for (u32 k = 0; k < 3; k++) lanes[k] += 1 << (FRACTION_BITS - 1);
+        }
+    }
+
+    const bool kernels_built = (build_kernels(), true);
+
+    /* Row kernels. pixels[n + REACH] is the kernel of pixel n,
+       for n in [-REACH, DISPLAY_WIDTH + REACH), and output pair m
+       sums tap t of pixel m + REACH - t. All three produce the same
+       output: clamp(sum >> FRACTION_BITS, 0, 255) per channel. */
+    typedef const i32 (*pixel_kernel_t)[LANES];
+    typedef void (*row_kernel_t)(const pixel_kernel_t *pixels, u32 *out);
+
+    void row_scalar(const pixel_kernel_t *pixels, u32 *out)
+    {
+        for (u32 m = 0; m < DISPLAY_WIDTH; m++)
+        {
+            i32 acc[LANES] = {};
+            for (u32 t = 0; t < TAPS; t++)
+            {
+                const i32 *k = pixels[m + 2 * REACH - t][t];
+                for (u32 l = 0; l < LANES; l++) acc[l] += k[l];
+            }
+
+            for (u32 q = 0; q < 2; q++)
+            {
+                u32 rgb = 0;
+                for (u32 c = 0; c < 3; c++)
+                    rgb |= std::clamp(acc[4 * q + c] >> FRACTION_BITS, 0, 255) << (8 * c);
+                out[2 * m + q] = rgb;
+            }
+        }
+    }
+
+#ifdef NTSC_HAVE_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+    SSE2 inline __m128i sum_sse2(const pixel_kernel_t *pixels, u32 m, u32 half)
+    {
+        __m128i acc = _mm_setzero_si128();
+        for (u32 t = 0; t < TAPS; t++)
+            acc = _mm_add_epi32(acc, _mm_load_si128(
+                reinterpret_cast<const __m128i *>(pixels[m + 2 * REACH - t][t] + 4 * half)));
+        return _mm_srai_epi32(acc, FRACTION_BITS);
+    }
+
+    // four output pixels at a time
+    SSE2 void row_sse2(const pixel_kernel_t *pixels, u32 *out)
+    {
+        for (u32 m = 0; m < DISPLAY_WIDTH; m += 2)
+        {
+            __m128i a = _mm_packs_epi32(sum_sse2(pixels, m, 0), sum_sse2(pixels, m, 1));
+            __m128i b = _mm_packs_epi32(sum_sse2(pixels, m + 1, 0), sum_sse2(pixels, m + 1, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * m), _mm_packus_epi16(a, b));
+        }
+    }
+
+    AVX2 inline __m256i sum_avx2(const pixel_kernel_t *pixels, u32 m)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        for (u32 t = 0; t < TAPS; t++)
+            acc = _mm256_add_epi32(acc, _mm256_load_si256(
+                reinterpret_cast<const __m256i *>(pixels[m + 2 * REACH - t][t])));
+        return _mm256_srai_epi32(acc, FRACTION_BITS);
+    }
+
+    // eight output pixels at a time
+    AVX2 void row_avx2(const pixel_kernel_t *pixels, u32 *out)
+    {
+        // the packs work within 128-bit lanes, leaving
+        // the pixels in the order 0 2 4 6 1 3 5 7
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        for (u32 m = 0; m < DISPLAY_WIDTH; m += 4)
+        {
+            __m256i a = _mm256_packs_epi32(sum_avx2(pixels, m + 0), sum_avx2(pixels, m + 1));
+            __m256i b = _mm256_packs_epi32(sum_avx2(pixels, m + 2), sum_avx2(pixels, m + 3));
+            __m256i rgb = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(a, b), order);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * m), rgb);
+        }
+    }
+
+#undef SSE2
+#undef AVX2
+
+#endif
+
+    row_kernel_t select_kernel()
+    {
+#ifdef NTSC_HAVE_X86
+        if (__builtin_cpu_supports("avx2")) return row_avx2;
+        if (__builtin_cpu_supports("sse2")) return row_sse2;
+#endif
+        return row_scalar;
+    }
+
+    const row_kernel_t row_kernel = select_kernel();
+
+    const char *kernel_name()
+    {
+#ifdef NTSC_HAVE_X86
+        if (row_kernel == row_avx2) return "avx2";
+        if (row_kernel == row_sse2) return "sse2";
+#endif
+        return "scalar";
+    }
+
+    void filter(const u8 *colors, const u8 *emphasis, u64 frame,
+                u32 first, u32 last, void *dst, size_t dst_pitch)
+    {
+        array<pixel_kernel_t, DISPLAY_WIDTH + 2 * REACH> pixels;
+        for (u32 n = 0; n < REACH; n++)
+        {
+            pixels[n] = kernels[BORDER][0];
+            pixels[DISPLAY_WIDTH + REACH + n] = kernels[BORDER][0];
+        }
+
+        u8 *out = static_cast<u8 *>(dst);
+        for (u32 v = first; v < last; v++, out += dst_pitch)
+        {
+            // a scanline is 341 * 8 samples, 4 phases more than
+            // a whole number of cycles, and odd frames are one
+            // dot shorter, so each frame starts 4 phases apart
+            u32 phase = (v + (frame & 1)) % PIXEL_PHASES;
+            const u8 *line = colors + v * DISPLAY_WIDTH;
+            u32 high = (emphasis[v] & 0b111) << 6;
+            for (u32 n = 0; n < DISPLAY_WIDTH; n++)
+            {
+                pixels[n + REACH] = kernels[(line[n] & 0x3F) | high][phase];
+                phase = phase == 0 ? 2 : phase - 1; // + 8 samples
+            }
+
+            row_kernel(pixels.data(), reinterpret_cast<u32 *>(out));
+        }
+    }
+
+    /* Filter thread, one frame behind the emulator. Each call to
+       pipeline() waits for the previous frame, which has had a
+       whole frame's time to finish, then queues the new one.
+       Like the scaler's pool, the state is never destroyed, so an
+       exit without stop() does not tear it down under the thread. */
+    struct Pipeline
+    {
+        array<u8, DISPLAY_WIDTH * DISPLAY_HEIGHT> colors;
+        array<u8, DISPLAY_HEIGHT> emphasis;
+        u64 frame;
+        array<vector<u32>, 2> results;
+        u32 result_index; // results buffer the current job writes
+        bool busy = false;
+        bool have_result = false;
+        bool running = false;
+        std::mutex mutex;
+        std::condition_variable job_ready;
+        std::condition_variable job_done;
+        std::thread worker;
+    };
+
+    Pipeline &pipe = *new Pipeline;
+
+    void worker_loop()
+    {
+        std::unique_lock<std::mutex> lock(pipe.mutex);
+        while (true)
+        {
+            pipe.job_ready.wait(lock, [] { return pipe.busy || !pipe.running; });
+            if (!pipe.running) break;
+
+            lock.unlock();
+            filter(pipe.colors.data(), pipe.emphasis.data(), pipe.frame, 0, DISPLAY_HEIGHT,
+                   pipe.results[pipe.result_index].data(), OUTPUT_WIDTH * sizeof(u32));
+            lock.lock();
+
+            pipe.busy = false;
+            pipe.job_done.notify_one();
+        }
+    }
+
+    const u32 *pipeline(const u8 *colors, const u8 *emphasis, u64 frame)
+    {
+        std::unique_lock<std::mutex> lock(pipe.mutex);
+        if (!pipe.running)
+        {
+            for (auto &result : pipe.results) result.resize(OUTPUT_WIDTH * DISPLAY_HEIGHT);
+            pipe.result_index = 0;
+            pipe.have_result = false;
+            pipe.running = true;
+            pipe.worker = std::thread(worker_loop);
+        }
+
+        pipe.job_done.wait(lock, [] { return !pipe.busy; });
+        const u32 *previous = nullptr;
+        if (pipe.have_result)
+        {
+            previous = pipe.results[pipe.result_index].data();
+            pipe.result_index ^= 1;
+        }
+
+        memcpy(pipe.colors.data(), colors, sizeof(pipe.colors));
+        memcpy(pipe.emphasis.data(), emphasis, sizeof(pipe.emphasis));
+        pipe.frame = frame;
+        pipe.busy = true;
+        pipe.have_result = true;
+        pipe.job_ready.notify_one();
+
+        return previous;
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(pipe.mutex);
+            if (!pipe.running) return;
+            pipe.running = false;
+        }
+        pipe.job_ready.notify_one();
+        pipe.worker.join();
+        pipe.busy = false;
+    }
+}
@@ -0,0 +1,275 @@
+#include "perfcounters.hpp"
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const u32 NUM_PHASES = static_cast<u32>(PerfCounters::Phase::Count);
+const u32 NUM_EVENTS = static_cast<u32>(PerfCounters::Event::Count);
+
+namespace PerfCounters
+{
+    typedef array<u64, NUM_EVENTS> Counts;
+    typedef array<Counts, NUM_PHASES> FrameCounts;
+
+    bool counting = false;
+
+    const char *phase_name(u32 phase)
+    {
+        static const array<const char *, NUM_PHASES> names { "host", "emulation", "render", "flip" };
+        return names[phase];
+    }
+
+    const char *event_name(u32 event)
+    {
+        static const array<const char *, NUM_EVENTS> names {
+            "cycles", "instructions", "branch_misses", "l1d_read_misses", "llc_misses"
+        };
+        return names[event];
+    }
+
+#ifdef __linux__
+
+    struct Counter
+    {
+        u32 type;
+        u64 config;
+    };
+
+    const array<Counter, NUM_EVENTS> COUNTERS {{
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    }};
+
+    int leader = -1;
+    vector<int> fds;
+    array<i32, NUM_EVENTS> slot; // position in a group read, -1 if unavailable
+    string output_name;
+
+    Counts last;
+    vector<Phase> phases;
+    FrameCounts current;
+    vector<FrameCounts> frames;
+
+    int open_counter(const Counter &counter, int group)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter.type;
+        attr.config = counter.config;
+        attr.disabled = group == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+
+    void close_all()
+    {
+        for (int fd : fds) close(fd);
+        fds.clear();
+        leader = -1;
+    }
+
+    bool read_counts(Counts &counts)
+    {
+        array<u64, 1 + NUM_EVENTS> values;
+        if (read(leader, values.data(), sizeof(values)) < static_cast<ssize_t>(sizeof(u64)))
+            return false;
+        for (u32 i = 0; i < NUM_EVENTS; i++)
+            counts[i] = slot[i] >= 0 ? values[1 + slot[i]] : 0;
+        return true;
+    }
+
+    // charges everything since the last read to the current phase
+    void charge()
+    {
+        Counts now;
+        if (!read_counts(now)) return;
+        Counts &target = current[static_cast<u32>(phases.back())];
+        for (u32 i = 0; i < NUM_EVENTS; i++)
+            target[i] += now[i] - last[i];
+        last = now;
+    }
+
+    void start(const string &file_name)
+    {
+        FILE *fp = fopen(file_name.c_str(), "w");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+        fclose(fp);
+
+        stop();
+        for (u32 i = 0; i < NUM_EVENTS; i++)
+        {
+            int fd = open_counter(COUNTERS[i], leader);
+            slot[i] = fd >= 0 ? static_cast<i32>(fds.size()) : -1;
+            if (fd < 0)
+            {
+                fprintf(stderr, "perf counter %s unavailable: %s\n", event_name(i), strerror(errno));
+                continue;
+            }
+            if (leader == -1) leader = fd;
+            fds.push_back(fd);
+        }
+
+        if (leader == -1)
+        {
+            fprintf(stderr, "no perf counters available, not counting\n");
+            return;
+        }
+
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        if (!read_counts(last))
+        {
+            fprintf(stderr, "could not read perf counters, not counting\n");
+            close_all();
+            return;
+        }
+
+        output_name = file_name;
+        phases.assign(1, Phase::Host);
+        current = FrameCounts {};
+        frames.clear();
+        counting = true;
+    }
+
+    bool active()
+    {
+        return counting;
+    }
+
+    void enter(Phase phase)
+    {
+        charge();
+        phases.push_back(phase);
+    }
+
+    void leave()
+    {
+        charge();
+        if (phases.size() > 1) phases.pop_back();
+    }
+
+    void on_frame()
+    {
+        charge();
+        frames.push_back(current);
+        current = FrameCounts {};
+    }
+
+    void write_frames()
+    {
+        FILE *fp = fopen(output_name.c_str(), "w");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + output_name);
+
+        fprintf(fp, "frame,phase");
+        for (u32 e = 0; e < NUM_EVENTS; e++) fprintf(fp, ",%s", event_name(e));
+        fprintf(fp, "\n");
+        for (u32 f = 0; f < frames.size(); f++)
+        {
+            for (u32 p = 0; p < NUM_PHASES; p++)
+            {
+                fprintf(fp, "%u,%s", f, phase_name(p));
+                for (u32 e = 0; e < NUM_EVENTS; e++)
+                {
+                    if (slot[e] >= 0) fprintf(fp, ",%lu", frames[f][p][e]);
+                    else fprintf(fp, ",");
+                }
+                fprintf(fp, "\n");
+            }
+        }
+        fclose(fp);
+    }
+
+    void print_summary()
+    {
+        FrameCounts totals {};
+        for (const FrameCounts &frame : frames)
+            for (u32 p = 0; p < NUM_PHASES; p++)
+                for (u32 e = 0; e < NUM_EVENTS; e++)
+                    totals[p][e] += frame[p][e];
+
+        auto per_frame = [&](u64 value)
+        {
+            return frames.empty() ? 0.0 : static_cast<double>(value) / frames.size();
+        };
+        auto ratio = [](u64 a, u64 b)
+        {
+            return b == 0 ? 0.0 : static_cast<double>(a) / b;
+        };
+        const u32 CYC = static_cast<u32>(Event::Cycles);
+        const u32 INS = static_cast<u32>(Event::Instructions);
+        const u32 BR = static_cast<u32>(Event::BranchMisses);
+
+        fprintf(stderr, "[PERF] %lu frames\n", frames.size());
+        fprintf(stderr, "[PERF] phase          cycles/frame    instrs/frame   IPC   br-miss/kinstr\n");
+        for (u32 p = 0; p < NUM_PHASES; p++)
+        {
+            const Counts &t = totals[p];
+            fprintf(stderr, "[PERF] %-10s %16.0f %15.0f %5.2f %16.2f\n", phase_name(p),
+                    per_frame(t[CYC]), per_frame(t[INS]), ratio(t[INS], t[CYC]),
+                    1000 * ratio(t[BR], t[INS]));
+        }
+    }
+
+    void stop()
+    {
+        if (!counting)
+        {
+            close_all();
+            return;
+        }
+        charge();
+        counting = false;
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        close_all();
+
+        write_frames();
+        print_summary();
+    }
+
+#else
+
+    void start(const string &file_name)
+    {
+        fprintf(stderr, "perf counters need Linux, not counting\n");
+    }
+
+    void stop()
+    {
+    }
+
+    bool active()
+    {
+        return false;
+    }
+
+    void enter(Phase phase)
+    {
+    }
+
+    void leave()
+    {
+    }
+
+    void on_frame()
+    {
+    }
+
+#endif
+}
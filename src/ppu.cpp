@@ -4,8 +4,18 @@
 #include "console.hpp"
 #include "mapper.hpp"
 #include "display.hpp"
+#include "videoexport.hpp"
 #include "palettedata.hpp"
 #include "ppuutils.hpp"
+#include "diag.hpp"
+#include "metrics.hpp"
+#include "timeline.hpp"
+#include "perfcounters.hpp"
+#include "debugger.hpp"
+#include "codedatalog.hpp"
+#include "movie.hpp"
+#include "savestate.hpp"
+#include "config.hpp"
 #include <exception>
 #include <cassert>
 #include <algorithm>
@@ -21,7 +31,6 @@ const u32 PALETTE_SIZE = 32;
 const u32 TILE_WIDTH = 8;
 const u32 TILE_HEIGHT = 8;
 
-const bool VERBOSE = false;
 
 namespace PPUMemory
 {
@@ -45,18 +54,29 @@ namespace PPUMemory
     u8 read(u16 address)
     {
         address = address % 0x4000;
+        Debugger::ppu_read(address);
         if (address < 0x2000) return Console::mapper->read(address);
-        if (address < 0x3F00) return PPU::Nametable::read(mirror_address(address) % 2048);
+        if (address < 0x3F00) return PPU::Nametable::read(mirror_address(address) % 0x1000);
         if (address < 0x4000) return PPU::Palette::read(address % 32);
         throw std::invalid_argument("invalid address in PPU memory read");
     }
 
+    // both planes of a pattern row, address being the first one's
+    u16 read_pattern(u16 address)
+    {
+        address = address % 0x2000;
+        Debugger::ppu_read(address);
+        Debugger::ppu_read(address + 8);
+        return Console::mapper->read_pattern(address);
+    }
+
     void write(u16 address, u8 value)
     {
         address = address % 0x4000;
+        Debugger::ppu_write(address, value);
         if (address < 0x2000) Console::mapper->write(address, value);
         else if (address < 0x3F00)
-                              PPU::Nametable::write(mirror_address(address) % 2048, value);
+                              PPU::Nametable::write(mirror_address(address) % 0x1000, value);
         else if (address < 0x4000)
                               PPU::Palette::write(address % 32, value);
         else throw std::invalid_argument("invalid address in PPU memory write");
@@ -100,13 +120,13 @@ namespace PPU
         {
             if (!latch) // first write
             {
-                if (VERBOSE) printf("[ADDR] Wrote value %X on first pass\n", value);
+                Diag::event<Diag::Category::PPURegs>("[ADDR] Wrote value %X on first pass", value);
                 temp_vram_address &= 0b11111111;
                 temp_vram_address |= (value & 0b111111) << 8;
             }
             else // second write
             {
-                if (VERBOSE) printf("[ADDR] Wrote value %X on second pass\n", value);
+                Diag::event<Diag::Category::PPURegs>("[ADDR] Wrote value %X on second pass", value);
                 temp_vram_address &= 0b1111111100000000;
                 temp_vram_address |= value;
                 vram_address = temp_vram_address;
@@ -138,7 +158,7 @@ namespace PPU
 
         void write(u8 value)
         {
-            if (VERBOSE) printf("[CTRL] Wrote value 0x%X to PPUCTRL\n", value);
+            Diag::event<Diag::Category::PPURegs>("[CTRL] Wrote value 0x%X to PPUCTRL", value);
 
             NN = value & 0b00000011;
             I  = (value & 0b00000100) > 0;
@@ -163,7 +183,7 @@ namespace PPU
                  | (P << 6)
                  | (V << 7);
 
-            if (VERBOSE) printf("[CTRL] Read value 0x%X from PPUCTRL\n", res);
+            Diag::event<Diag::Category::PPURegs>("[CTRL] Read value 0x%X from PPUCTRL", res);
 
             return res;
         }
@@ -193,7 +213,7 @@ namespace PPU
             emph_G = value & 0b01000000;
             emph_B = value & 0b10000000;
 
-            if (VERBOSE) printf("[MASK] Wrote value 0x%X to PPUMASK\n", value);
+            Diag::event<Diag::Category::PPURegs>("[MASK] Wrote value 0x%X to PPUMASK", value);
         }
 
         u8 read()
@@ -207,7 +227,7 @@ namespace PPU
                  | (emph_G << 6)
                  | (emph_B << 7);
 
-            if (VERBOSE) printf("[MASK] Read value 0x%X from PPUMASK\n", res);
+            Diag::event<Diag::Category::PPURegs>("[MASK] Read value 0x%X from PPUMASK", res);
 
             return res;
         }
@@ -241,7 +261,7 @@ namespace PPU
             latch = false;
             V = false;
             
-            if (VERBOSE) printf("[STATUS] Read value 0x%X from PPUSTATUS\n", res);
+            Diag::event<Diag::Category::PPURegs>("[STATUS] Read value 0x%X from PPUSTATUS", res);
             return res;
         }
     }
@@ -274,7 +294,7 @@ namespace PPU
 
 
             latch = !latch;
-            if (VERBOSE) printf("[SCROLL] Wrote value 0x%X to PPUSCROLL\n", value);
+            Diag::event<Diag::Category::PPURegs>("[SCROLL] Wrote value 0x%X to PPUSCROLL", value);
         }
     }
 
@@ -284,6 +304,7 @@ namespace PPU
 
         u8 read()
         {
+            CodeDataLog::ppu_kind = CodeDataLog::CHR_READ;
             u8 res = PPUMemory::read(ADDR::vram_address);
             if (ADDR::vram_address % 0x4000 < 0x3F00)
             {
@@ -293,9 +314,10 @@ namespace PPU
             {
                 buffer = PPUMemory::read(ADDR::vram_address - 0x1000);
             }
+            CodeDataLog::ppu_kind = CodeDataLog::CHR_RENDERED;
 
             ADDR::vram_address += (CTRL::I) ? 32 : 1;
-            if (VERBOSE) printf("[DATA] Read value 0x%X to PPUDATA\n", res);
+            Diag::event<Diag::Category::PPURegs>("[DATA] Read value 0x%X to PPUDATA", res);
             return res;
         }
 
@@ -303,7 +325,7 @@ namespace PPU
         {
             PPUMemory::write(ADDR::vram_address, value);
             ADDR::vram_address += (CTRL::I) ? 32 : 1;
-            if (VERBOSE) printf("[DATA] Wrote value 0x%X to PPUDATA\n", value);
+            Diag::event<Diag::Category::PPURegs>("[DATA] Wrote value 0x%X to PPUDATA", value);
 
         }
     }
@@ -312,16 +334,26 @@ namespace PPU
     {
         array<u8, 2048> data;
 
+        // the console has two tables; four-screen boards bring memory
+        // for the other two, which is where addresses past data go
         void write(u16 address, u8 value)
         {
+            if (address >= data.size())
+            {
+                Cartridge::vram[address - data.size()] = value;
+                return;
+            }
             data[address] = value;
-            if (VERBOSE) printf("[Nametable] Wrote value 0x%X to address 0x%X\n", value, address);
+            Config::HeatmapPolicy::write(Heatmap::Region::Nametable, address);
+            Diag::event<Diag::Category::PPUMemory>("[Nametable] Wrote value 0x%X to address 0x%X", value, address);
         }
 
         u8 read(u16 address)
         {
+            if (address >= data.size()) return Cartridge::vram[address - data.size()];
             u8 res = data[address];
-            if (VERBOSE) printf("[Nametable] Read value 0x%X from nametable\n", res);
+            Config::HeatmapPolicy::read(Heatmap::Region::Nametable, address);
+            Diag::event<Diag::Category::PPUMemory>("[Nametable] Read value 0x%X from nametable", res);
             return res;
         }
     }
@@ -358,7 +390,8 @@ namespace PPU
         u8 read(u16 address)
         {
             u8 res = data[mirror(address)];
-            if (VERBOSE) printf("[PALETTE] Read value 0x%X from palette\n", res);
+            Config::HeatmapPolicy::read(Heatmap::Region::Palette, mirror(address));
+            Diag::event<Diag::Category::PPUMemory>("[PALETTE] Read value 0x%X from palette", res);
 
             return res;
         }
@@ -366,7 +399,8 @@ namespace PPU
         void write(u16 address, u8 value)
         {
             data[mirror(address)] = value;
-            if (VERBOSE) printf("[PALETTE] Wrote value 0x%X to palette\n", value);
+            Config::HeatmapPolicy::write(Heatmap::Region::Palette, mirror(address));
+            Diag::event<Diag::Category::PPUMemory>("[PALETTE] Wrote value 0x%X to palette", value);
         }
 
         u32 read_rgb(u16 address)
@@ -387,13 +421,13 @@ namespace PPU
 
         struct SpritePixel
         {
-            u32 rgb;
+            u8 color; // index into PaletteData
             bool is_opaque;
             bool sprite_behind_bg;
             u8 sprite_index;
 
-            SpritePixel(u32 rgb, bool is_opaque, bool sprite_behind_bg, u8 sprite_index) :
-                rgb(rgb), is_opaque(is_opaque), sprite_behind_bg(sprite_behind_bg),
+            SpritePixel(u8 color, bool is_opaque, bool sprite_behind_bg, u8 sprite_index) :
+                color(color), is_opaque(is_opaque), sprite_behind_bg(sprite_behind_bg),
                 sprite_index(sprite_index)
             {
             }
@@ -425,7 +459,7 @@ namespace PPU
                         //     case 2: rgb = 0x888888; break;
                         //     case 3: rgb = 0XAAAAAA; break;
                         // }
-                        return SpritePixel(Palette::read_rgb(4 * (palette + 4) + pixel), true, priority, i);
+                        return SpritePixel(Palette::read(4 * (palette + 4) + pixel), true, priority, i);
                     }
                 }
             }
@@ -436,29 +470,31 @@ namespace PPU
         u8 read_address()
         {
             u8 res = address;
-            if (VERBOSE) printf("[OAM] Read value 0x%X from OAMADDR\n", res);
+            Diag::event<Diag::Category::OAM>("[OAM] Read value 0x%X from OAMADDR", res);
             return res;
         }
 
         u8 read_data()
         {
             u8 res = data[address];
-            if (VERBOSE) printf("[OAM] Read value 0x%X from OAMDATA\n", res);
+            Config::HeatmapPolicy::read(Heatmap::Region::OAM, address);
+            Diag::event<Diag::Category::OAM>("[OAM] Read value 0x%X from OAMDATA", res);
             return res;
         }
 
         void write_address(u8 _address)
         {
             address = _address;
-            if (VERBOSE) printf("[OAM] Wrote value 0x%X to OAMADDR\n", _address);
+            Diag::event<Diag::Category::OAM>("[OAM] Wrote value 0x%X to OAMADDR", _address);
         }
 
         void write_data(u8 value)
         {
+            Config::HeatmapPolicy::write(Heatmap::Region::OAM, address);
             data[address++] = value;
             // TODO: should not increment
             //       during vblank
-            if (VERBOSE) printf("[OAM] Wrote value 0x%X to OAMDATA\n", value);
+            Diag::event<Diag::Category::OAM>("[OAM] Wrote value 0x%X to OAMDATA", value);
 
         }
 
@@ -466,13 +502,16 @@ namespace PPU
         {
             u16 addr = value << 8;
             for (u32 i = 0; i < 0x100; i++)
+            {
+                Config::HeatmapPolicy::write(Heatmap::Region::OAM, address);
                 data[address++] = CPUMemory::read(addr++);
+            }
 
             CPU::stall += 513;
 
             if (CPU::cycles % 2 == 1)
                 CPU::stall += 1;
-            if (VERBOSE) printf("[OAM] OAM DMA complete\n");
+            Diag::event<Diag::Category::DMA>("[OAM] OAM DMA from $%04X complete, %u stall cycles", value << 8, CPU::stall);
 
         }
 
@@ -552,6 +591,7 @@ namespace PPU
 
     void vertical_blank()
     {
+        Timeline::Scope span("vertical_blank", frame_count);
         // for (u8 row = 0; row < 30; row++)
         // {
         //     for (u8 col = 0; col < 32; col++)
@@ -625,7 +665,13 @@ namespace PPU
         //     }
         // }
 
-        Display::flip();
+        {
+            Metrics::Timer timer(Metrics::Counter::HostFlipNs);
+            Timeline::Scope span("flip", frame_count);
+            PerfCounters::Scope phase(PerfCounters::Phase::Flip);
+            Display::flip();
+        }
+        VideoExport::push_frame();
 
 
         if (CTRL::V)
@@ -639,42 +685,52 @@ namespace PPU
         u8 row = scan_line;
         assert(row < 240);
 
+        u32 *line = Display::row(row);
+        u8 *colors = Display::color_row(row);
+
+        u16 pattern = 0;
         for (u32 col = 0; col < 256; col++)
         {
             u16 nametable_index = col / 8 + (row / 8) * 32;
             u8 fetched = PPUMemory::read(0x2000 + nametable_index);
             u16 bg_offset = CTRL::B ? 0x1000 : 0;
-            u8 first  = PPUUtils::reverse_byte(PPUMemory::read(bg_offset + 16 * fetched + (row % 8)));
-            u8 second = PPUUtils::reverse_byte(PPUMemory::read(bg_offset + 16 * fetched + (row % 8) + 8));
-            u8 pixel = 2 * get_bit(second, col % 8) + get_bit(first, col % 8);
+            // once a tile, as the PPU fetches it
+            if (col % 8 == 0) pattern = PPUMemory::read_pattern(bg_offset + 16 * fetched + (row % 8));
+            u8 pixel = (pattern >> (2 * (col % 8))) & 0b11;
             u16 attrib_idx = (col / 32) + (row / 32) * 8;
             u8 attrib = PPUMemory::read(0x23C0 + attrib_idx);
             u8 palette = (attrib >> Palette::get_shift(row / 8, col / 8)) & 0b11;
 
-            u32 rgb_bg;
+            u8 color_bg;
             bool bg_opaque = pixel > 0;
             if (bg_opaque)
-                rgb_bg = PaletteData::data[Palette::read(4 * palette + pixel)];
+                color_bg = Palette::read(4 * palette + pixel);
             else
-                rgb_bg = PaletteData::data[Palette::read(0)];
+                color_bg = Palette::read(0);
             
             OAM::SpritePixel sp = OAM::evaluate_row_pixel(col);
             bool sprite_opaque = sp.is_opaque;
-            u32 rgb_sprite = sp.rgb;
+            u8 color_sprite = sp.color;
             bool sprite_behind_bg = sp.sprite_behind_bg;
 
+            u8 color = 0;
             switch ((bg_opaque << 2) | (sprite_opaque << 1) | sprite_behind_bg)
             {
-                case 0b000: Display::writePixel(col, row, rgb_bg); break;
-                case 0b001: Display::writePixel(col, row, rgb_bg); break;
-                case 0b010: Display::writePixel(col, row, rgb_sprite); break;
-                case 0b011: Display::writePixel(col, row, rgb_sprite); break;
-                case 0b100: Display::writePixel(col, row, rgb_bg); break;
-                case 0b101: Display::writePixel(col, row, rgb_bg); break;
-                case 0b110: Display::writePixel(col, row, rgb_sprite); break;
-                case 0b111: Display::writePixel(col, row, rgb_bg); break;
+                case 0b000: color = color_bg; break;
+                case 0b001: color = color_bg; break;
+                case 0b010: color = color_sprite; break;
+                case 0b011: color = color_sprite; break;
+                case 0b100: color = color_bg; break;
+                case 0b101: color = color_bg; break;
+                case 0b110: color = color_sprite; break;
+                case 0b111: color = color_bg; break;
             }
+
+            colors[col] = color;
+            line[col] = PaletteData::data[color];
         }
+
+        Display::end_row(row, (MASK::emph_R << 0) | (MASK::emph_G << 1) | (MASK::emph_B << 2));
     }
 
     u64 vblank_start_cycle;
@@ -689,6 +745,7 @@ namespace PPU
                 dot == NUM_DOTS - 1
         ))
         {
+            Metrics::add(Metrics::Counter::PPUDots, dot);
             dot = 0;
             scan_line++;
         }
@@ -696,6 +753,10 @@ namespace PPU
         {
             scan_line = 0;
             frame_count++;
+            Metrics::add(Metrics::Counter::Frames);
+            PerfCounters::frame();
+            Config::HeatmapPolicy::frame();
+            Movie::frame();
         }
 
         /* Rendering logic goes here */
@@ -717,15 +778,25 @@ namespace PPU
 
         if (dot == 257)
         {
-            if (scan_line < 240) draw_row();
+            Metrics::Timer timer(Metrics::Counter::HostRenderNs);
+            PerfCounters::Scope phase(PerfCounters::Phase::Render);
+            if (scan_line < 240)
+            {
+                Timeline::Scope span("draw_row", scan_line);
+                draw_row();
+            }
             if (scan_line < 239 || scan_line == NUM_SCAN_LINES - 1) 
-                                 evaluate_sprites();
+            {
+                Timeline::Scope span("evaluate_sprites", scan_line);
+                evaluate_sprites();
+            }
         }
     }
 
     u8 read_register(u16 address)
     {
-        if (VERBOSE) printf("[PPUREG] Reading register 0x%X\n", address);
+        Diag::event<Diag::Category::PPURegs>("[PPUREG] Reading register 0x%X", address);
+        Metrics::add(Metrics::register_counter(Metrics::Counter::RegisterReads, address));
         switch (static_cast<Register>(address))
         {
             case Register::PPUCTRL:   return CTRL::read();        // 0x2000
@@ -741,7 +812,11 @@ namespace PPU
 
     void write_register(u16 address, u8 value)
     {
-        if (VERBOSE) printf("Writing to register 0x%X\n", address);
+        Diag::event<Diag::Category::PPURegs>("[PPUREG] Writing value 0x%X to register 0x%X", value, address);
+        if (address == static_cast<u16>(Register::OAMDMA))
+            Metrics::add(Metrics::Counter::OAMDMATransfers);
+        else
+            Metrics::add(Metrics::register_counter(Metrics::Counter::RegisterWrites, address));
         switch (static_cast<Register>(address))
         {
             case Register::PPUCTRL: 
@@ -773,6 +848,34 @@ namespace PPU
         }
     }
 
+    void serialize(SaveState::Stream &s)
+    {
+        s.field(latch);
+        s.field(scan_line);
+        s.field(dot);
+        s.field(frame_count);
+        s.field(ADDR::temp_vram_address);
+        s.field(ADDR::vram_address);
+        s.field(ADDR::fine_x_scroll);
+        for (bool *bit : { &CTRL::I, &CTRL::S, &CTRL::B, &CTRL::H, &CTRL::P, &CTRL::V,
+                           &MASK::G, &MASK::m, &MASK::M, &MASK::b, &MASK::s,
+                           &MASK::emph_R, &MASK::emph_G, &MASK::emph_B,
+                           &STATUS::O, &STATUS::S, &STATUS::V })
+            s.field(*bit);
+        s.field(CTRL::NN);
+        s.field(STATUS::reserved);
+        s.field(DATA::buffer);
+        s.field(Nametable::data);
+        s.field(Palette::data);
+        s.field(OAM::data);
+        s.field(OAM::secondary_data);
+        s.field(OAM::shift_reg_1);
+        s.field(OAM::shift_reg_2);
+        s.field(OAM::latches);
+        s.field(OAM::counters);
+        s.field(OAM::address);
+    }
+
     void init()
     {
         latch = false;
@@ -0,0 +1,218 @@
+#include "profiler.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+
+const u8 OPCODE_JSR = 0x20;
+const u8 OPCODE_RTI = 0x40;
+const u8 OPCODE_RTS = 0x60;
+const u32 MAX_DEPTH = 64; // deeper calls are charged to the frame at this depth
+
+namespace Profiler
+{
+#ifdef NES_PROFILE
+
+    enum class Kind : u8
+    {
+        Root,
+        Call,
+        NMI,
+        IRQ
+    };
+
+    // one node per distinct call stack, so a node's cycles
+    // are the self cycles of a line of the folded output
+    struct Node
+    {
+        u32 parent;
+        u16 entry;
+        Kind kind;
+        u64 cycles;
+    };
+
+    struct Frame
+    {
+        u32 node;
+        u8 sp; // SP before the call pushed its return address
+    };
+
+    struct Hotspot
+    {
+        u64 cycles;
+        u64 count;
+        u16 entry; // routine the PC last ran in
+        u8 opcode;
+    };
+
+    bool profiling = false;
+    vector<Node> nodes;
+    std::unordered_map<u64, u32> children;
+    vector<Frame> stack;
+    vector<Hotspot> hotspots(0x10000);
+    u64 first_frame;
+
+    u32 child(u32 parent, Kind kind, u16 entry)
+    {
+        u64 key = (static_cast<u64>(parent) << 24) | (static_cast<u64>(kind) << 16) | entry;
+        auto it = children.find(key);
+        if (it != children.end()) return it->second;
+
+        nodes.push_back({ parent, entry, kind, 0 });
+        children[key] = nodes.size() - 1;
+        return nodes.size() - 1;
+    }
+
+    void push(Kind kind, u8 sp)
+    {
+        if (stack.size() >= MAX_DEPTH) return;
+        stack.push_back({ child(stack.back().node, kind, CPU::PC), sp });
+    }
+
+    void start()
+    {
+        nodes.assign(1, { 0, CPU::PC, Kind::Root, 0 });
+        children.clear();
+        stack.assign(1, { 0, 0xFF });
+        std::fill(hotspots.begin(), hotspots.end(), Hotspot { 0, 0, 0, 0 });
+        first_frame = PPU::frame_count;
+        profiling = true;
+    }
+
+    void stop()
+    {
+        profiling = false;
+    }
+
+    bool active()
+    {
+        return profiling;
+    }
+
+    void on_instruction(u16 pc, u8 opcode, u32 cycles)
+    {
+        const Frame &frame = stack.back();
+        nodes[frame.node].cycles += cycles;
+        Hotspot &h = hotspots[pc];
+        h.cycles += cycles;
+        h.count++;
+        h.entry = nodes[frame.node].entry;
+        h.opcode = opcode;
+
+        if (opcode == OPCODE_JSR)
+        {
+            push(Kind::Call, CPU::SP + 2);
+        }
+        else if (opcode == OPCODE_RTS || opcode == OPCODE_RTI)
+        {
+            // pop every frame the stack pointer is now above.
+            // An RTS used as a jump through a pushed address
+            // leaves SP below the frame, and pops nothing.
+            while (stack.size() > 1 && stack.back().sp <= CPU::SP)
+                stack.pop_back();
+        }
+    }
+
+    void on_interrupt(bool nmi)
+    {
+        push(nmi ? Kind::NMI : Kind::IRQ, CPU::SP + 3);
+    }
+
+    void on_stall(u32 cycles)
+    {
+        nodes[stack.back().node].cycles += cycles;
+    }
+
+    string name(const Node &node)
+    {
+        const char *prefix = "sub";
+        switch (node.kind)
+        {
+            case Kind::Root: prefix = "reset"; break;
+            case Kind::Call: prefix = "sub"; break;
+            case Kind::NMI: prefix = "nmi"; break;
+            case Kind::IRQ: prefix = "irq"; break;
+        }
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%s_%04X", prefix, node.entry);
+        return buf;
+    }
+
+    void save_folded(const string &file_name)
+    {
+        FILE *fp = fopen(file_name.c_str(), "w");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        vector<string> paths(nodes.size());
+        for (u32 i = 0; i < nodes.size(); i++)
+        {
+            // parents are always created before their children
+            paths[i] = i == 0 ? name(nodes[i]) : paths[nodes[i].parent] + ";" + name(nodes[i]);
+            if (nodes[i].cycles > 0)
+                fprintf(fp, "%s %lu\n", paths[i].c_str(), nodes[i].cycles);
+        }
+        fclose(fp);
+    }
+
+    void save_hotspots(const string &file_name, u32 count)
+    {
+        FILE *fp = fopen(file_name.c_str(), "w");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        vector<u32> order(hotspots.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [](u32 a, u32 b)
+        {
+            return hotspots[a].cycles > hotspots[b].cycles;
+        });
+
+        u64 total = 0;
+        for (const Hotspot &h : hotspots) total += h.cycles;
+        u64 frames = std::max<u64>(1, PPU::frame_count - first_frame);
+
+        fprintf(fp, "%lu cycles over %lu frames\n\n", total, frames);
+        fprintf(fp, "  PC   instr   executions        cycles      %%  cycles/frame  routine\n");
+        for (u32 i = 0; i < count && i < order.size(); i++)
+        {
+            const Hotspot &h = hotspots[order[i]];
+            if (h.cycles == 0) break;
+            fprintf(fp, "%04X   %-5s %12lu  %12lu  %5.2f  %12.1f  %04X\n",
+                    order[i], CPU::instructionNames[h.opcode].c_str(),
+                    h.count, h.cycles, 100.0 * h.cycles / total,
+                    static_cast<double>(h.cycles) / frames, h.entry);
+        }
+        fclose(fp);
+    }
+
+#else
+
+    void start()
+    {
+        throw std::runtime_error("built without NES_PROFILE");
+    }
+
+    void stop()
+    {
+    }
+
+    bool active()
+    {
+        return false;
+    }
+
+    void save_folded(const string &file_name)
+    {
+        throw std::runtime_error("built without NES_PROFILE");
+    }
+
+    void save_hotspots(const string &file_name, u32 count)
+    {
+        throw std::runtime_error("built without NES_PROFILE");
+    }
+
+#endif
+}
@@ -0,0 +1,79 @@
+#include "savestate.hpp"
+#include "console.hpp"
+#include "cartridge.hpp"
+#include "mapper.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "input.hpp"
+#include "display.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace SaveState
+{
+    Stream::Stream(vector<u8> &data, bool loading) :
+        data(data),
+        position(0),
+        loading(loading)
+    {
+    }
+
+    void Stream::bytes(void *field, size_t size)
+    {
+        if (!loading)
+        {
+            const u8 *p = static_cast<const u8 *>(field);
+            data.insert(data.end(), p, p + size);
+            return;
+        }
+
+        if (position + size > data.size())
+            throw std::runtime_error("snapshot is too short for this machine");
+        memcpy(field, data.data() + position, size);
+        position += size;
+    }
+
+    bool Stream::done() const
+    {
+        return position == data.size();
+    }
+
+    void serialize(Stream &s)
+    {
+        CPU::serialize(s);
+        s.field(Console::ram);
+        PPU::serialize(s);
+        Console::mapper->serialize(s);
+        s.field(Cartridge::sram);
+        s.field(Cartridge::chr_ram_data); // empty with CHR-ROM, which never changes
+        s.field(Cartridge::vram);
+        Input::controller1.serialize(s);
+        Input::controller2.serialize(s);
+    }
+
+    vector<u8> save()
+    {
+        vector<u8> state;
+        save(state);
+        return state;
+    }
+
+    void save(vector<u8> &state)
+    {
+        state.clear();
+        Stream s(state, false);
+        serialize(s);
+    }
+
+    void load(vector<u8> &state)
+    {
+        Stream s(state, true);
+        serialize(s);
+        if (!s.done())
+            throw std::runtime_error("snapshot is too long for this machine");
+
+        // the frame buffer isn't part of a snapshot, so whatever is
+        // shown has to be uploaded again once the next frame is drawn
+        Display::invalidate();
+    }
+}
@@ -0,0 +1,463 @@
+#include "scaler.hpp"
+#include "display.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCALER_HAVE_X86 1
+#endif
+
+const u32 PADDED_WIDTH = DISPLAY_WIDTH + 2; // one replicated pixel on each side
+const u32 MAX_FACTOR = 4;
+
+// hqx's YUV similarity thresholds
+const i32 THRESHOLD_Y = 48;
+const i32 THRESHOLD_U = 7;
+const i32 THRESHOLD_V = 6;
+
+namespace Scaler
+{
+    /* Neighbourhood of one source row: index 1 is the row itself,
+       0 and 2 the rows above and below. Rows are padded, so pixel
+       x of a row is at index x + 1. */
+    struct Rows
+    {
+        const u32 *rgb[3];
+        const u32 *yuv[3];
+    };
+
+    // writes the output pixels of source pixels [x_begin, x_end) to
+    // the factor() output rows of the current source row
+    typedef void (*kernel_t)(const Rows &rows, u32 *const *out, u32 x_begin, u32 x_end);
+
+    // Y in bits 16-23, U in 8-15, V in 0-7
+    u32 rgb_to_yuv(u32 rgb)
+    {
+        i32 r = (rgb >> 16) & 0xFF;
+        i32 g = (rgb >> 8) & 0xFF;
+        i32 b = (rgb >> 0) & 0xFF;
+        i32 y = (77 * r + 150 * g + 29 * b) >> 8;
+        i32 u = ((-43 * r - 85 * g + 128 * b) >> 8) + 128;
+        i32 v = ((128 * r - 107 * g - 21 * b) >> 8) + 128;
+        return (std::clamp(y, 0, 255) << 16) |
+               (std::clamp(u, 0, 255) << 8) |
+               (std::clamp(v, 0, 255) << 0);
+    }
+
+    bool similar(u32 a, u32 b)
+    {
+        auto diff = [a, b](u32 shift)
+        {
+            return std::abs(static_cast<i32>((a >> shift) & 0xFF) -
+                            static_cast<i32>((b >> shift) & 0xFF));
+        };
+        return diff(16) <= THRESHOLD_Y && diff(8) <= THRESHOLD_U && diff(0) <= THRESHOLD_V;
+    }
+
+    // per-channel average rounding up, like pavgb
+    u32 average(u32 a, u32 b)
+    {
+        return (a | b) - (((a ^ b) >> 1) & 0x7F7F7F7F);
+    }
+
+    // 3/4 a + 1/4 b
+    u32 blend(u32 a, u32 b)
+    {
+        return average(a, average(a, b));
+    }
+
+    /* Scalar kernels */
+
+    template <u32 F>
+    void nearest_scalar(const Rows &rows, u32 *const *out, u32 x_begin, u32 x_end)
+    {
+        const u32 *row = rows.rgb[1] + 1;
+        for (u32 x = x_begin; x < x_end; x++)
+            for (u32 k = 0; k < F; k++) out[0][F * x + k] = row[x];
+        for (u32 j = 1; j < F; j++)
+            memcpy(out[j] + F * x_begin, out[0] + F * x_begin, F * (x_end - x_begin) * sizeof(u32));
+    }
+
+    void scale2x_scalar(const Rows &rows, u32 *const *out, u32 x_begin, u32 x_end)
+    {
+        for (u32 x = x_begin; x < x_end; x++)
+        {
+            u32 B = rows.rgb[0][x + 1];
+            u32 D = rows.rgb[1][x], E = rows.rgb[1][x + 1], F = rows.rgb[1][x + 2];
+            u32 H = rows.rgb[2][x + 1];
+            bool edge = B != H && D != F;
+            out[0][2 * x + 0] = edge && D == B ? D : E;
+            out[0][2 * x + 1] = edge && B == F ? F : E;
+            out[1][2 * x + 0] = edge && D == H ? D : E;
+            out[1][2 * x + 1] = edge && H == F ? F : E;
+        }
+    }
+
+    void scale3x_scalar(const Rows &rows, u32 *const *out, u32 x_begin, u32 x_end)
+    {
+        for (u32 x = x_begin; x < x_end; x++)
+        {
+            u32 A = rows.rgb[0][x], B = rows.rgb[0][x + 1], C = rows.rgb[0][x + 2];
+            u32 D = rows.rgb[1][x], E = rows.rgb[1][x + 1], F = rows.rgb[1][x + 2];
+            u32 G = rows.rgb[2][x], H = rows.rgb[2][x + 1], I = rows.rgb[2][x + 2];
+            bool edge = B != H && D != F;
+            out[0][3 * x + 0] = edge && D == B ? D : E;
+            out[0][3 * x + 1] = edge && ((D == B && E != C) || (B == F && E != A)) ? B : E;
+            out[0][3 * x + 2] = edge && B == F ? F : E;
+            out[1][3 * x + 0] = edge && ((D == B && E != G) || (D == H && E != A)) ? D : E;
+            out[1][3 * x + 1] = E;
+            out[1][3 * x + 2] = edge && ((B == F && E != I) || (H == F && E != C)) ? F : E;
+            out[2][3 * x + 0] = edge && D == H ? D : E;
+            out[2][3 * x + 1] = edge && ((D == H && E != I) || (H == F && E != G)) ? H : E;
+            out[2][3 * x + 2] = edge && H == F ? F : E;
+        }
+    }
+
+    void smooth2x_scalar(const Rows &rows, u32 *const *out, u32 x_begin, u32 x_end)
+    {
+        for (u32 x = x_begin; x < x_end; x++)
+        {
+            u32 D = rows.rgb[1][x], E = rows.rgb[1][x + 1], F = rows.rgb[1][x + 2];
+            u32 yB = rows.yuv[0][x + 1];
+            u32 yD = rows.yuv[1][x], yF = rows.yuv[1][x + 2];
+            u32 yH = rows.yuv[2][x + 1];
+            bool edge = !similar(yB, yH) && !similar(yD, yF);
+            out[0][2 * x + 0] = edge && similar(yD, yB) ? blend(D, E) : E;
+            out[0][2 * x + 1] = edge && similar(yB, yF) ? blend(F, E) : E;
+            out[1][2 * x + 0] = edge && similar(yD, yH) ? blend(D, E) : E;
+            out[1][2 * x + 1] = edge && similar(yH, yF) ? blend(F, E) : E;
+        }
+    }
+
+#ifdef SCALER_HAVE_X86
+
+    /* AVX2 kernels, eight source pixels at a time. They produce
+       exactly the same output as the scalar kernels above. */
+
+#define AVX2 __attribute__((target("avx2")))
+
+    AVX2 inline __m256i load(const u32 *p)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    }
+
+    AVX2 inline void store(u32 *p, __m256i v)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+    }
+
+    AVX2 inline __m256i eq(__m256i a, __m256i b)
+    {
+        return _mm256_cmpeq_epi32(a, b);
+    }
+
+    // mask ? a : b
+    AVX2 inline __m256i select(__m256i mask, __m256i a, __m256i b)
+    {
+        return _mm256_blendv_epi8(b, a, mask);
+    }
+
+    // lane i of output vector k takes source pixel (8k + i) / f
+    AVX2 inline __m256i spread(u32 f, u32 k)
+    {
+        return _mm256_setr_epi32((8 * k + 0) / f, (8 * k + 1) / f, (8 * k + 2) / f, (8 * k + 3) / f,
+                                 (8 * k + 4) / f, (8 * k + 5) / f, (8 * k + 6) / f, (8 * k + 7) / f);
+    }
+
+    // store a0 b0 a1 b1 ... a7 b7
+    AVX2 inline void store2(u32 *p, __m256i a, __m256i b)
+    {
+        __m256i lo = _mm256_unpacklo_epi32(a, b);
+        __m256i hi = _mm256_unpackhi_epi32(a, b);
+        store(p + 0, _mm256_permute2x128_si256(lo, hi, 0x20));
+        store(p + 8, _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    // store a0 b0 c0 a1 b1 c1 ... a7 b7 c7
+    AVX2 inline void store3(u32 *p, __m256i a, __m256i b, __m256i c)
+    {
+        // output k, lane i comes from vector (8k + i) % 3 at element (8k + i) / 3
+        const __m256i i0 = spread(3, 0), i1 = spread(3, 1), i2 = spread(3, 2);
+        store(p + 0, _mm256_blend_epi32(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(a, i0),
+                                                           _mm256_permutevar8x32_epi32(b, i0), 0x92),
+                                        _mm256_permutevar8x32_epi32(c, i0), 0x24));
+        store(p + 8, _mm256_blend_epi32(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(a, i1),
+                                                           _mm256_permutevar8x32_epi32(b, i1), 0x24),
+                                        _mm256_permutevar8x32_epi32(c, i1), 0x49));
+        store(p + 16, _mm256_blend_epi32(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(a, i2),
+                                                            _mm256_permutevar8x32_epi32(b, i2), 0x49),
+                                         _mm256_permutevar8x32_epi32(c, i2), 0x92));
+    }
+
+    template <u32 F>
+    AVX2 void nearest_avx2(const Rows &rows, u32 *const *out, u32 x_begin, u32 x_end)
+    {
+        const u32 *row = rows.rgb[1] + 1;
+        u32 x = x_begin;
+        for (; x + 8 <= x_end; x += 8)
+        {
+            __m256i v = load(row + x);
+            for (u32 k = 0; k < F; k++)
+                store(out[0] + F * x + 8 * k, _mm256_permutevar8x32_epi32(v, spread(F, k)));
+        }
+        for (; x < x_end; x++)
+            for (u32 k = 0; k < F; k++) out[0][F * x + k] = row[x];
+        for (u32 j = 1; j < F; j++)
+            memcpy(out[j] + F * x_begin, out[0] + F * x_begin, F * (x_end - x_begin) * sizeof(u32));
+    }
+
+    AVX2 void scale2x_avx2(const Rows &rows, u32 *const *out, u32 x_begin, u32 x_end)
+    {
+        u32 x = x_begin;
+        for (; x + 8 <= x_end; x += 8)
+        {
+            __m256i B = load(rows.rgb[0] + x + 1);
+            __m256i D = load(rows.rgb[1] + x), E = load(rows.rgb[1] + x + 1), F = load(rows.rgb[1] + x + 2);
+            __m256i H = load(rows.rgb[2] + x + 1);
+            __m256i flat = _mm256_or_si256(eq(B, H), eq(D, F));
+            store2(out[0] + 2 * x, select(_mm256_andnot_si256(flat, eq(D, B)), D, E),
+                                   select(_mm256_andnot_si256(flat, eq(B, F)), F, E));
+            store2(out[1] + 2 * x, select(_mm256_andnot_si256(flat, eq(D, H)), D, E),
+                                   select(_mm256_andnot_si256(flat, eq(H, F)), F, E));
+        }
+        scale2x_scalar(rows, out, x, x_end);
+    }
+
+    AVX2 void scale3x_avx2(const Rows &rows, u32 *const *out, u32 x_begin, u32 x_end)
+    {
+        u32 x = x_begin;
+        for (; x + 8 <= x_end; x += 8)
+        {
+            __m256i A = load(rows.rgb[0] + x), B = load(rows.rgb[0] + x + 1), C = load(rows.rgb[0] + x + 2);
+            __m256i D = load(rows.rgb[1] + x), E = load(rows.rgb[1] + x + 1), F = load(rows.rgb[1] + x + 2);
+            __m256i G = load(rows.rgb[2] + x), H = load(rows.rgb[2] + x + 1), I = load(rows.rgb[2] + x + 2);
+            __m256i flat = _mm256_or_si256(eq(B, H), eq(D, F));
+            __m256i DB = eq(D, B), BF = eq(B, F), DH = eq(D, H), HF = eq(H, F);
+
+            // (p && E != q) || (r && E != s), on edges only
+            auto cond = [flat, E](__m256i p, __m256i q, __m256i r, __m256i s) AVX2
+            {
+                __m256i m = _mm256_or_si256(_mm256_andnot_si256(eq(E, q), p),
+                                            _mm256_andnot_si256(eq(E, s), r));
+                return _mm256_andnot_si256(flat, m);
+            };
+
+            store3(out[0] + 3 * x, select(_mm256_andnot_si256(flat, DB), D, E),
+                                   select(cond(DB, C, BF, A), B, E),
+                                   select(_mm256_andnot_si256(flat, BF), F, E));
+            store3(out[1] + 3 * x, select(cond(DB, G, DH, A), D, E),
+                                   E,
+                                   select(cond(BF, I, HF, C), F, E));
+            store3(out[2] + 3 * x, select(_mm256_andnot_si256(flat, DH), D, E),
+                                   select(cond(DH, I, HF, G), H, E),
+                                   select(_mm256_andnot_si256(flat, HF), F, E));
+        }
+        scale3x_scalar(rows, out, x, x_end);
+    }
+
+    AVX2 inline __m256i similar_avx2(__m256i a, __m256i b)
+    {
+        const __m256i thresholds = _mm256_set1_epi32((THRESHOLD_Y << 16) | (THRESHOLD_U << 8) | THRESHOLD_V);
+        __m256i diff = _mm256_sub_epi8(_mm256_max_epu8(a, b), _mm256_min_epu8(a, b));
+        return eq(_mm256_subs_epu8(diff, thresholds), _mm256_setzero_si256());
+    }
+
+    AVX2 inline __m256i blend_avx2(__m256i a, __m256i b)
+    {
+        return _mm256_avg_epu8(a, _mm256_avg_epu8(a, b));
+    }
+
+    AVX2 void smooth2x_avx2(const Rows &rows, u32 *const *out, u32 x_begin, u32 x_end)
+    {
+        u32 x = x_begin;
+        for (; x + 8 <= x_end; x += 8)
+        {
+            __m256i D = load(rows.rgb[1] + x), E = load(rows.rgb[1] + x + 1), F = load(rows.rgb[1] + x + 2);
+            __m256i yB = load(rows.yuv[0] + x + 1);
+            __m256i yD = load(rows.yuv[1] + x), yF = load(rows.yuv[1] + x + 2);
+            __m256i yH = load(rows.yuv[2] + x + 1);
+            __m256i flat = _mm256_or_si256(similar_avx2(yB, yH), similar_avx2(yD, yF));
+            __m256i DE = blend_avx2(D, E), FE = blend_avx2(F, E);
+            store2(out[0] + 2 * x, select(_mm256_andnot_si256(flat, similar_avx2(yD, yB)), DE, E),
+                                   select(_mm256_andnot_si256(flat, similar_avx2(yB, yF)), FE, E));
+            store2(out[1] + 2 * x, select(_mm256_andnot_si256(flat, similar_avx2(yD, yH)), DE, E),
+                                   select(_mm256_andnot_si256(flat, similar_avx2(yH, yF)), FE, E));
+        }
+        smooth2x_scalar(rows, out, x, x_end);
+    }
+
+#undef AVX2
+
+#endif
+
+    struct FilterInfo
+    {
+        u32 factor;
+        bool needs_yuv;
+        kernel_t scalar;
+        kernel_t avx2;
+    };
+
+    FilterInfo info(Filter filter)
+    {
+#ifdef SCALER_HAVE_X86
+#define KERNELS(scalar, avx2) scalar, avx2
+#else
+#define KERNELS(scalar, avx2) scalar, scalar
+#endif
+        switch (filter)
+        {
+            case Filter::None:      return { 1, false, KERNELS(nearest_scalar<1>, nearest_avx2<1>) };
+            case Filter::Nearest2x: return { 2, false, KERNELS(nearest_scalar<2>, nearest_avx2<2>) };
+            case Filter::Nearest3x: return { 3, false, KERNELS(nearest_scalar<3>, nearest_avx2<3>) };
+            case Filter::Nearest4x: return { 4, false, KERNELS(nearest_scalar<4>, nearest_avx2<4>) };
+            case Filter::Scale2x:   return { 2, false, KERNELS(scale2x_scalar, scale2x_avx2) };
+            case Filter::Scale3x:   return { 3, false, KERNELS(scale3x_scalar, scale3x_avx2) };
+            case Filter::Smooth2x:  return { 2, true, KERNELS(smooth2x_scalar, smooth2x_avx2) };
+        }
+#undef KERNELS
+        throw std::invalid_argument("unknown scaler filter");
+    }
+
+    bool avx2_supported()
+    {
+#ifdef SCALER_HAVE_X86
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    const bool use_avx2 = avx2_supported();
+
+    const char *kernel_name()
+    {
+        return use_avx2 ? "avx2" : "scalar";
+    }
+
+    u32 factor(Filter filter)
+    {
+        return info(filter).factor;
+    }
+
+    void scale_band(const FilterInfo &filter, const u32 *src, u32 first, u32 last,
+                    u8 *dst, size_t dst_pitch)
+    {
+        kernel_t kernel = use_avx2 ? filter.avx2 : filter.scalar;
+        array<array<u32, PADDED_WIDTH>, 3> rgb;
+        array<array<u32, PADDED_WIDTH>, 3> yuv;
+
+        // row r lives in slot (r + 3) % 3, so r - 1, r and r + 1
+        // are always in different slots as the band advances
+        auto load_row = [&](i32 r)
+        {
+            u32 slot = (r + 3) % 3;
+            const u32 *line = src + std::clamp<i32>(r, 0, DISPLAY_HEIGHT - 1) * DISPLAY_WIDTH;
+            u32 *padded = rgb[slot].data();
+            padded[0] = line[0];
+            memcpy(padded + 1, line, DISPLAY_WIDTH * sizeof(u32));
+            padded[PADDED_WIDTH - 1] = line[DISPLAY_WIDTH - 1];
+            if (filter.needs_yuv)
+                for (u32 i = 0; i < PADDED_WIDTH; i++) yuv[slot][i] = rgb_to_yuv(padded[i]);
+        };
+
+        load_row(static_cast<i32>(first) - 1);
+        load_row(first);
+        for (u32 v = first; v < last; v++)
+        {
+            load_row(v + 1);
+
+            Rows rows;
+            for (u32 i = 0; i < 3; i++)
+            {
+                rows.rgb[i] = rgb[(v + 2 + i) % 3].data();
+                rows.yuv[i] = yuv[(v + 2 + i) % 3].data();
+            }
+
+            u32 *out[MAX_FACTOR];
+            for (u32 k = 0; k < filter.factor; k++)
+                out[k] = reinterpret_cast<u32 *>(dst + ((v - first) * filter.factor + k) * dst_pitch);
+
+            kernel(rows, out, 0, DISPLAY_WIDTH);
+        }
+    }
+
+    /* A small pool of band workers, shared by all callers. Workers
+       are detached, so the pool is never destroyed: they may still
+       be waiting on it while the process exits. */
+    struct BandPool
+    {
+        std::mutex callers; // one scale() call at a time
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::condition_variable work_done;
+        std::function<void(u32)> job;
+        u64 generation = 0;
+        u32 num_workers = 0;
+        u32 pending = 0;
+    };
+
+    BandPool &pool = *new BandPool;
+
+    void worker_loop(u32 band)
+    {
+        u64 seen = 0;
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        while (true)
+        {
+            pool.work_ready.wait(lock, [&seen] { return pool.generation != seen; });
+            seen = pool.generation;
+            lock.unlock();
+            pool.job(band);
+            lock.lock();
+            if (--pool.pending == 0) pool.work_done.notify_one();
+        }
+    }
+
+    void run_bands(u32 bands, const std::function<void(u32)> &band)
+    {
+        std::lock_guard<std::mutex> guard(pool.callers);
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        while (pool.num_workers < bands - 1)
+            std::thread(worker_loop, ++pool.num_workers).detach();
+
+        pool.job = band;
+        pool.pending = pool.num_workers;
+        pool.generation++;
+        pool.work_ready.notify_all();
+        lock.unlock();
+
+        band(0);
+
+        lock.lock();
+        pool.work_done.wait(lock, [] { return pool.pending == 0; });
+    }
+
+    void scale(Filter filter, const u32 *src, u32 first, u32 last,
+               void *dst, size_t dst_pitch, u32 threads)
+    {
+        const FilterInfo fi = info(filter);
+        u8 *out = static_cast<u8 *>(dst);
+        u32 rows = last - first;
+        threads = std::max<u32>(1, std::min(threads, rows));
+
+        if (threads == 1)
+        {
+            scale_band(fi, src, first, last, out, dst_pitch);
+            return;
+        }
+
+        run_bands(threads, [&](u32 i)
+        {
+            if (i >= threads) return;
+            u32 a = first + rows * i / threads;
+            u32 b = first + rows * (i + 1) / threads;
+            scale_band(fi, src, a, b, out + (a - first) * fi.factor * dst_pitch, dst_pitch);
+        });
+    }
+}
@@ -0,0 +1,403 @@
+#include "search.hpp"
+#include "savestate.hpp"
+#include "ppu.hpp"
+#include "input.hpp"
+#include "movie.hpp"
+#include "crc.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#ifdef __unix__
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// the ranges are shared between processes, which needs real atomics
+static_assert(std::atomic<u64>::is_always_lock_free, "work ranges need lock-free 64-bit atomics");
+
+const char GO = 'g';
+
+namespace Search
+{
+    // a worker's children still to play, [first, end)
+    struct alignas(64) Range
+    {
+        std::atomic<u64> bounds;
+    };
+
+    struct Child
+    {
+        double score;
+        u32 ram_crc; // children with the same RAM are the same to the beam
+        bool valid;  // false if the move threw
+    };
+
+    // everything the workers see, in one shared mapping: the ranges,
+    // then the beam's snapshots, then every child's Child and snapshot
+    struct Level
+    {
+        u8 *memory = NULL;
+        size_t size = 0;
+        size_t state_size = 0;
+        size_t stride = 0; // of the children, keeping each Child aligned
+        Range *ranges = NULL;
+        u8 *parents = NULL;
+        u8 *children = NULL;
+
+        u8 *parent_state(u32 parent)
+        {
+            return parents + parent * state_size;
+        }
+
+        Child &child(u32 index)
+        {
+            return *reinterpret_cast<Child *>(children + index * stride);
+        }
+
+        u8 *child_state(u32 index)
+        {
+            return children + index * stride + sizeof(Child);
+        }
+    };
+
+    // the worker processes: each waits on its own go pipe for a level
+    // and says it is done on the shared one
+    struct Workers
+    {
+        vector<int> go;
+        vector<pid_t> pids; // -1 once reaped
+        int done = -1;      // the read end; the workers have the write end
+    };
+
+    size_t aligned(size_t size)
+    {
+        return (size + alignof(Child) - 1) / alignof(Child) * alignof(Child);
+    }
+
+    u64 pack(u32 first, u32 end)
+    {
+        return first | static_cast<u64>(end) << 32;
+    }
+
+    // first and end only move towards each other during a level, so a
+    // range never holds the same value twice and a CAS can't be fooled
+    bool take(Range &range, u32 &task)
+    {
+        u64 bounds = range.bounds.load();
+        while (true)
+        {
+            u32 first = bounds;
+            u32 end = bounds >> 32;
+            if (first >= end) return false;
+            if (range.bounds.compare_exchange_weak(bounds, pack(first + 1, end)))
+            {
+                task = first;
+                return true;
+            }
+        }
+    }
+
+    // moves the back half of the largest range left into worker's own
+    bool steal(Range *ranges, u32 workers, u32 worker)
+    {
+        while (true)
+        {
+            u32 victim = workers;
+            u32 most = 0;
+            u64 seen = 0;
+            for (u32 w = 0; w < workers; w++)
+            {
+                u64 bounds = ranges[w].bounds.load();
+                u32 first = bounds;
+                u32 end = bounds >> 32;
+                if (w == worker || first >= end || end - first <= most) continue;
+                victim = w;
+                most = end - first;
+                seen = bounds;
+            }
+            if (victim == workers) return false;
+
+            u32 first = seen;
+            u32 end = seen >> 32;
+            u32 middle = end - (most + 1) / 2;
+            if (ranges[victim].bounds.compare_exchange_strong(seen, pack(first, middle)))
+            {
+                // nobody steals from an empty range, so this is ours alone
+                ranges[worker].bounds.store(pack(middle, end));
+                return true;
+            }
+        }
+    }
+
+    void play(Level &level, const Options &options, const Score &score, u32 task, vector<u8> &state)
+    {
+        u32 parent = task / options.moves.size();
+        const u8 *from = level.parent_state(parent);
+        state.assign(from, from + level.state_size);
+        SaveState::load(state);
+
+        Child &child = level.child(task);
+        try
+        {
+            Input::controller1.setButtons(options.moves[task % options.moves.size()]);
+            u64 end = PPU::frame_count + options.frames_per_move;
+            while (PPU::frame_count < end) Console::execute();
+        }
+        catch (...)
+        {
+            // the game crashed into something the emulator doesn't do;
+            // not a path worth keeping
+            child.valid = false;
+            return;
+        }
+
+        child.score = score(Console::ram);
+        child.ram_crc = crc32(Console::ram.data(), Console::ram.size());
+        child.valid = !std::isnan(child.score);
+        SaveState::save(state);
+        memcpy(level.child_state(task), state.data(), level.state_size);
+    }
+
+    void work(Level &level, const Options &options, const Score &score, u32 worker, u32 workers)
+    {
+        vector<u8> state;
+        state.reserve(level.state_size);
+        u32 task;
+        while (true)
+        {
+            if (take(level.ranges[worker], task)) play(level, options, score, task, state);
+            else if (!steal(level.ranges, workers, worker)) break;
+        }
+    }
+
+    // the next beam: the best children, one per distinct RAM
+    vector<u32> select(Level &level, u32 count, u32 beam)
+    {
+        vector<u32> order;
+        for (u32 i = 0; i < count; i++)
+            if (level.child(i).valid) order.push_back(i);
+        std::stable_sort(order.begin(), order.end(), [&level](u32 a, u32 b)
+        {
+            return level.child(a).score > level.child(b).score;
+        });
+
+        vector<u32> kept;
+        vector<u32> seen;
+        for (u32 i : order)
+        {
+            if (kept.size() == beam) break;
+            u32 ram_crc = level.child(i).ram_crc;
+            if (std::find(seen.begin(), seen.end(), ram_crc) != seen.end()) continue;
+            seen.push_back(ram_crc);
+            kept.push_back(i);
+        }
+        return kept;
+    }
+
+#ifdef __unix__
+    // starts every worker on a level and waits for them all. A worker
+    // killed by a signal never replies, so while waiting keep checking
+    // that none has exited.
+    void play_level(Workers &processes)
+    {
+        for (int fd : processes.go)
+            if (write(fd, &GO, 1) != 1)
+                throw std::runtime_error("a search worker went away");
+
+        for (size_t replies = 0; replies < processes.pids.size();)
+        {
+            pollfd done { processes.done, POLLIN, 0 };
+            int ready = poll(&done, 1, 100);
+            if (ready < 0 && errno != EINTR)
+                throw std::runtime_error("could not wait for the search workers");
+            if (ready > 0)
+            {
+                char reply;
+                if (read(processes.done, &reply, 1) != 1)
+                    throw std::runtime_error("a search worker went away");
+                replies++;
+                continue;
+            }
+            for (pid_t &pid : processes.pids)
+                if (waitpid(pid, NULL, WNOHANG) != 0)
+                {
+                    pid = -1;
+                    throw std::runtime_error("a search worker went away");
+                }
+        }
+    }
+
+    // ends the workers and reaps them, killing them first if the
+    // search failed and some may still be playing
+    void stop(Workers &processes, bool kill_them)
+    {
+        for (int fd : processes.go) close(fd);
+        for (pid_t pid : processes.pids)
+        {
+            if (pid < 0) continue;
+            if (kill_them) kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        if (processes.done >= 0) close(processes.done);
+        processes = Workers();
+    }
+#endif
+
+    Result run(const Options &options, const Score &score)
+    {
+        if (options.moves.empty() || options.depth == 0 || options.beam == 0 || options.frames_per_move == 0)
+            throw std::invalid_argument("a search needs moves, depth, a beam and frames per move");
+
+        vector<u8> root = SaveState::save();
+        u32 moves = options.moves.size();
+        u32 max_children = options.beam * moves;
+        u32 workers = std::max(1u, std::min(options.workers, max_children));
+
+        Level level;
+        level.state_size = root.size();
+        level.stride = aligned(sizeof(Child) + level.state_size);
+        size_t ranges_size = sizeof(Range) * workers;
+        size_t parents_size = aligned(options.beam * level.state_size);
+        level.size = ranges_size + parents_size + max_children * level.stride;
+#ifdef __unix__
+        void *memory = mmap(NULL, level.size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            throw std::runtime_error("could not map search memory");
+        level.memory = static_cast<u8 *>(memory);
+#else
+        level.memory = new u8[level.size];
+#endif
+        // nothing a clone plays goes into a movie being recorded
+        Movie::Mode movie_mode = Movie::mode;
+        Movie::mode = Movie::Mode::Off;
+
+        level.ranges = reinterpret_cast<Range *>(level.memory);
+        for (u32 w = 0; w < workers; w++) new (&level.ranges[w]) Range;
+        level.parents = level.memory + ranges_size;
+        level.children = level.parents + parents_size;
+
+        Workers processes;
+#ifdef __unix__
+        // a worker that died leaves its go pipe without a reader; that
+        // should fail the write, not kill the search with SIGPIPE
+        struct sigaction ignore {};
+        struct sigaction sigpipe;
+        ignore.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &ignore, &sigpipe);
+
+        int done[2];
+        if (workers > 1 && pipe(done) == 0)
+        {
+            fflush(stdout);
+            for (u32 w = 0; w < workers; w++)
+            {
+                int fds[2];
+                if (pipe(fds) != 0) break;
+                pid_t pid = fork();
+                if (pid < 0)
+                {
+                    close(fds[0]);
+                    close(fds[1]);
+                    break;
+                }
+                if (pid == 0)
+                {
+                    // nothing may unwind out of here into the copy of
+                    // the caller's stack; the parent sees the exit as
+                    // a worker gone away
+                    close(fds[1]);
+                    close(done[0]);
+                    try
+                    {
+                        char command;
+                        while (read(fds[0], &command, 1) == 1 && command == GO)
+                        {
+                            work(level, options, score, w, workers);
+                            if (write(done[1], &command, 1) != 1) break;
+                        }
+                    }
+                    catch (...)
+                    {
+                        _exit(1);
+                    }
+                    _exit(0);
+                }
+                close(fds[0]);
+                processes.go.push_back(fds[1]);
+                processes.pids.push_back(pid);
+            }
+            // only the workers write to it, so it reads end of file
+            // once they are all gone
+            close(done[1]);
+            processes.done = done[0];
+        }
+#endif
+        // fewer processes than planned play the levels with fewer workers
+        workers = std::max<u32>(1, processes.go.size());
+
+        memcpy(level.parent_state(0), root.data(), level.state_size);
+        vector<vector<u8>> paths { {} };
+        Result result { {}, -INFINITY, 0 };
+        try
+        {
+            for (u32 depth = 0; depth < options.depth; depth++)
+            {
+                u32 children = paths.size() * moves;
+                for (u32 w = 0; w < workers; w++)
+                    level.ranges[w].bounds.store(pack(children * w / workers, children * (w + 1) / workers));
+
+                if (processes.go.empty()) work(level, options, score, 0, 1);
+#ifdef __unix__
+                else play_level(processes);
+#endif
+                result.clones += children;
+
+                vector<u32> kept = select(level, children, options.beam);
+                if (kept.empty()) break; // every move crashed the game
+
+                vector<vector<u8>> next_paths;
+                for (u32 beam = 0; beam < kept.size(); beam++)
+                {
+                    u32 child = kept[beam];
+                    next_paths.push_back(paths[child / moves]);
+                    next_paths.back().push_back(options.moves[child % moves]);
+                    memcpy(level.parent_state(beam), level.child_state(child), level.state_size);
+                }
+                paths = std::move(next_paths);
+                result.moves = paths[0];
+                result.score = level.child(kept[0]).score;
+            }
+        }
+        catch (...)
+        {
+#ifdef __unix__
+            stop(processes, true);
+            sigaction(SIGPIPE, &sigpipe, NULL);
+            munmap(level.memory, level.size);
+#else
+            delete[] level.memory;
+#endif
+            SaveState::load(root);
+            Movie::mode = movie_mode;
+            throw;
+        }
+
+#ifdef __unix__
+        stop(processes, false);
+        sigaction(SIGPIPE, &sigpipe, NULL);
+        munmap(level.memory, level.size);
+#else
+        delete[] level.memory;
+#endif
+        SaveState::load(root);
+        Movie::mode = movie_mode;
+        return result;
+    }
+}
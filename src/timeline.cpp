@@ -0,0 +1,88 @@
+#include "timeline.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+namespace Timeline
+{
+    struct Span
+    {
+        const char *name;
+        i64 arg;
+        i64 begin_ns;
+        i64 end_ns;
+        u32 thread;
+    };
+
+    bool recording = false;
+    string output_name;
+    vector<Span> spans;
+    std::atomic<u64> next_span { 0 };
+    std::atomic<u32> next_thread { 0 };
+    thread_local u32 thread_id = next_thread++;
+    std::chrono::steady_clock::time_point origin;
+
+    void start(const string &file_name, u32 capacity)
+    {
+        FILE *fp = fopen(file_name.c_str(), "w");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+        fclose(fp);
+
+        output_name = file_name;
+        spans.assign(capacity, Span {});
+        next_span = 0;
+        origin = std::chrono::steady_clock::now();
+        recording = true;
+    }
+
+    bool active()
+    {
+        return recording;
+    }
+
+    i64 since_origin(std::chrono::steady_clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin).count();
+    }
+
+    void record(const char *name, i64 arg,
+                std::chrono::steady_clock::time_point begin,
+                std::chrono::steady_clock::time_point end)
+    {
+        // spans already open when recording started
+        if (begin < origin) return;
+
+        u64 index = next_span.fetch_add(1, std::memory_order_relaxed);
+        if (index < spans.size())
+            spans[index] = { name, arg, since_origin(begin), since_origin(end), thread_id };
+    }
+
+    void stop()
+    {
+        if (!recording) return;
+        recording = false;
+
+        FILE *fp = fopen(output_name.c_str(), "w");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + output_name);
+
+        u64 count = std::min<u64>(next_span, spans.size());
+        fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"nes-cpp\"}}");
+        for (u64 i = 0; i < count; i++)
+        {
+            const Span &s = spans[i];
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                    s.name, s.thread, s.begin_ns / 1000.0, (s.end_ns - s.begin_ns) / 1000.0);
+            if (s.arg >= 0) fprintf(fp, ",\"args\":{\"value\":%ld}", s.arg);
+            fprintf(fp, "}");
+        }
+        fprintf(fp, "\n]}\n");
+        fclose(fp);
+
+        if (next_span > spans.size())
+            fprintf(stderr, "timeline buffer full, dropped %lu spans\n", next_span - spans.size());
+        spans = vector<Span>();
+    }
+}
@@ -0,0 +1,213 @@
+#include "trace.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char TRACE_MAGIC[8] = { 'N', 'E', 'S', 'T', 'R', 'A', 'C', 'E' };
+const u32 TRACE_VERSION = 1;
+
+namespace Trace
+{
+    size_t file_size(u64 capacity)
+    {
+        return sizeof(Header) + capacity * sizeof(Record);
+    }
+
+#ifdef NES_TRACE
+
+    bool recording = false;
+    Triggers triggers;
+    Header *header;
+    Record *records;
+    vector<u8> memory;
+    int fd = -1;
+    size_t mapped_size;
+
+    void begin(u8 *base, u64 capacity, const Triggers &_triggers)
+    {
+        header = reinterpret_cast<Header *>(base);
+        records = reinterpret_cast<Record *>(base + sizeof(Header));
+        memcpy(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header->version = TRACE_VERSION;
+        header->record_size = sizeof(Record);
+        header->capacity = capacity;
+        header->count = 0;
+        triggers = _triggers;
+        recording = true;
+    }
+
+    void start_memory(u64 capacity, const Triggers &_triggers)
+    {
+        if (recording) throw std::runtime_error("trace already recording");
+        if (capacity == 0) throw std::invalid_argument("trace capacity must be nonzero");
+
+        memory.assign(file_size(capacity), 0);
+        begin(memory.data(), capacity, _triggers);
+    }
+
+    void start_file(const string &file_name, u64 capacity, const Triggers &_triggers)
+    {
+        if (recording) throw std::runtime_error("trace already recording");
+        if (capacity == 0) throw std::invalid_argument("trace capacity must be nonzero");
+
+        fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("could not open " + file_name);
+
+        mapped_size = file_size(capacity);
+        void *base = ftruncate(fd, mapped_size) == 0
+            ? mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (base == MAP_FAILED)
+        {
+            // no trace left half started: stop() and the next start
+            // both take fd >= 0 to mean a recording
+            close(fd);
+            fd = -1;
+            throw std::runtime_error("could not size or map " + file_name);
+        }
+
+        begin(static_cast<u8 *>(base), capacity, _triggers);
+    }
+
+    void save(const string &file_name)
+    {
+        if (memory.empty()) throw std::runtime_error("no in-memory trace to save");
+
+        FILE *fp = fopen(file_name.c_str(), "wb");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        u64 used = std::min(header->count, header->capacity);
+        fwrite(memory.data(), 1, file_size(used), fp);
+        fclose(fp);
+    }
+
+    void stop()
+    {
+        recording = false;
+        if (fd < 0) return;
+
+        // a ring that never wrapped only needs its used part
+        u64 used = std::min(header->count, header->capacity);
+        munmap(header, mapped_size);
+        if (ftruncate(fd, file_size(used)) < 0)
+            throw std::runtime_error("could not truncate trace file");
+        close(fd);
+        fd = -1;
+    }
+
+    void record()
+    {
+        if (CPU::PC < triggers.pc_first || CPU::PC > triggers.pc_last) return;
+        if (PPU::frame_count < triggers.frame_first || PPU::frame_count > triggers.frame_last) return;
+        if (CPU::cycles < triggers.cycle_first || CPU::cycles > triggers.cycle_last) return;
+
+        records[header->count % header->capacity] = capture();
+        header->count++;
+    }
+
+#else
+
+    void start_memory(u64 capacity, const Triggers &_triggers)
+    {
+        throw std::runtime_error("built without NES_TRACE");
+    }
+
+    void start_file(const string &file_name, u64 capacity, const Triggers &_triggers)
+    {
+        throw std::runtime_error("built without NES_TRACE");
+    }
+
+    void save(const string &file_name)
+    {
+        throw std::runtime_error("built without NES_TRACE");
+    }
+
+    void stop()
+    {
+    }
+
+#endif
+
+    Record capture()
+    {
+        Record r;
+        r.cycle = CPU::cycles;
+        r.frame = PPU::frame_count;
+        r.pc = CPU::PC;
+        r.dot = PPU::dot;
+        r.line = PPU::scan_line;
+        r.vram_address = PPU::ADDR::vram_address;
+        r.temp_vram_address = PPU::ADDR::temp_vram_address;
+
+        // only the bytes of the instruction itself, so that
+        // no extra bus reads can touch I/O registers
+        r.bytes[0] = CPUMemory::read(CPU::PC);
+        r.size = CPU::instructionSizes[r.bytes[0]];
+        r.bytes[1] = r.size > 1 ? CPUMemory::read(CPU::PC + 1) : 0;
+        r.bytes[2] = r.size > 2 ? CPUMemory::read(CPU::PC + 2) : 0;
+
+        r.a = CPU::A;
+        r.x = CPU::X;
+        r.y = CPU::Y;
+        r.p = CPU::flags();
+        r.sp = CPU::SP;
+        r.unused = 0;
+        return r;
+    }
+
+    vector<Record> load(const string &file_name)
+    {
+        FILE *fp = fopen(file_name.c_str(), "rb");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file_name);
+
+        Header h;
+        if (fread(&h, sizeof(h), 1, fp) != 1 ||
+            memcmp(h.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+            h.version != TRACE_VERSION || h.record_size != sizeof(Record))
+        {
+            fclose(fp);
+            throw std::runtime_error(file_name + " is not a trace file");
+        }
+
+        u64 used = std::min(h.count, h.capacity);
+        vector<Record> ring(used);
+        size_t got = fread(ring.data(), sizeof(Record), used, fp);
+        fclose(fp);
+        if (got != used)
+            throw std::runtime_error(file_name + " is truncated");
+
+        // unroll the ring, oldest record first
+        if (h.count > h.capacity)
+            std::rotate(ring.begin(), ring.begin() + h.count % h.capacity, ring.end());
+        return ring;
+    }
+
+    string format(const Record &r, Style style)
+    {
+        char w1[3] = "  ", w2[3] = "  ";
+        if (r.size > 1) snprintf(w1, sizeof(w1), "%02X", r.bytes[1]);
+        if (r.size > 2) snprintf(w2, sizeof(w2), "%02X", r.bytes[2]);
+
+        // the PPU position is derived from the cycle count, like
+        // CPU::printInstruction, so that logs compare line by line
+        u64 dot = (r.cycle * 3) % 341;
+        u64 line = ((3 * r.cycle) / 341) % 261;
+
+        char out[160];
+        int n = snprintf(out, sizeof(out), "%s%04X  %02X %s %s  %s %27s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3lu,%3lu",
+                         style == Style::Console ? "[CPU] " : "",
+                         r.pc, r.bytes[0], w1, w2, CPU::instructionNames[r.bytes[0]].c_str(), "",
+                         r.a, r.x, r.y, r.p, r.sp, dot, line);
+        if (style == Style::Console)
+            snprintf(out + n, sizeof(out) - n, " V:%04X T:%04X", r.vram_address, r.temp_vram_address);
+        return out;
+    }
+}
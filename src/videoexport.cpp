@@ -0,0 +1,290 @@
+#include "videoexport.hpp"
+#include "display.hpp"
+#include "config.hpp"
+#include "ppu.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <exception>
+#include <fcntl.h>
+#include <unistd.h>
+
+const u32 QUEUE_SLOTS = 8;
+const size_t WRITE_BUFFER_BYTES = 4 << 20;
+const u32 FRAME_PIXELS = DISPLAY_WIDTH * DISPLAY_HEIGHT;
+
+namespace VideoExport
+{
+    struct Slot
+    {
+        array<u32, FRAME_PIXELS> rgb;
+        array<u8, FRAME_PIXELS> colors;
+        u64 frame; // PPU::frame_count when it was pushed
+    };
+
+    vector<Slot> slots;
+    u64 head; // next slot the emulator fills
+    u64 tail; // next slot the writer drains
+    bool running = false;
+    std::exception_ptr failure; // what stopped the writer, for stop()
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::thread writer;
+
+    int fd = -1;
+    Format format;
+    vector<u8> out;
+    vector<u32> scaled;
+    bool skip_duplicates;
+    FILE *frames_fp = NULL; // what frame each one written is, with skip_duplicates
+    u32 last_hash;
+    bool have_last_hash;
+    struct sigaction sigpipe; // as it was before start()
+
+    Format format_for(const string &file_name)
+    {
+        auto ends_with = [&file_name](const string &ext)
+        {
+            return file_name.size() >= ext.size() &&
+                   file_name.compare(file_name.size() - ext.size(), ext.size(), ext) == 0;
+        };
+
+        if (ends_with(".rgb")) return Format::RGB;
+        if (ends_with(".idx")) return Format::Indexed;
+        return Format::Y4M;
+    }
+
+    void write_all(const u8 *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(string("video export write failed: ") + strerror(errno));
+            }
+            data += n;
+            size -= n;
+        }
+    }
+
+    void flush()
+    {
+        write_all(out.data(), out.size());
+        out.clear();
+    }
+
+    u32 scale_factor()
+    {
+        // palette indices are exported unscaled
+        return format == Format::Indexed ? 1 : Scaler::factor(Config::VIDEO_FILTER);
+    }
+
+    void encode(const Slot &slot)
+    {
+        const u32 *rgb = slot.rgb.data();
+        const u32 f = scale_factor();
+        const u32 pixels = FRAME_PIXELS * f * f;
+        if (f > 1)
+        {
+            Scaler::scale(Config::VIDEO_FILTER, rgb, 0, DISPLAY_HEIGHT, scaled.data(),
+                          DISPLAY_WIDTH * f * sizeof(u32), Config::SCALER_THREADS);
+            rgb = scaled.data();
+        }
+
+        switch (format)
+        {
+            case Format::Y4M:
+            {
+                const char *tag = "FRAME\n";
+                out.insert(out.end(), tag, tag + strlen(tag));
+                size_t y = out.size();
+                size_t u = y + pixels;
+                size_t v = u + pixels;
+                out.resize(v + pixels);
+                for (u32 i = 0; i < pixels; i++)
+                {
+                    i32 r = (rgb[i] >> 16) & 0xFF;
+                    i32 g = (rgb[i] >> 8) & 0xFF;
+                    i32 b = (rgb[i] >> 0) & 0xFF;
+                    // BT.601, studio range
+                    out[y + i] = (( 66 * r + 129 * g +  25 * b + 128) >> 8) +  16;
+                    out[u + i] = ((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+                    out[v + i] = ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+                }
+                break;
+            }
+            case Format::RGB:
+            {
+                size_t base = out.size();
+                out.resize(base + 3 * pixels);
+                u8 *dst = out.data() + base;
+                for (u32 i = 0; i < pixels; i++)
+                {
+                    *dst++ = rgb[i] >> 16;
+                    *dst++ = rgb[i] >> 8;
+                    *dst++ = rgb[i] >> 0;
+                }
+                break;
+            }
+            case Format::Indexed:
+                out.insert(out.end(), slot.colors.begin(), slot.colors.end());
+                break;
+        }
+        if (frames_fp != NULL) fprintf(frames_fp, "%lu\n", slot.frame);
+
+        if (out.size() >= WRITE_BUFFER_BYTES) flush();
+    }
+
+    void drain()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            not_empty.wait(lock, [] { return tail != head || !running; });
+            if (tail == head) break; // stopped and drained
+
+            const Slot &slot = slots[tail % QUEUE_SLOTS];
+            lock.unlock();
+            encode(slot);
+            lock.lock();
+
+            tail++;
+            not_full.notify_one();
+        }
+
+        lock.unlock();
+        flush();
+    }
+
+    // a failed write ends the export, not the process: the error waits
+    // for stop() on the emulation thread, and frames are dropped
+    void writer_loop()
+    {
+        try
+        {
+            drain();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            failure = std::current_exception();
+            not_full.notify_one();
+        }
+    }
+
+    void start(const string &file_name, Format _format)
+    {
+        if (running) throw std::runtime_error("video export already running");
+
+        fd = (file_name == "-") ?
+            STDOUT_FILENO :
+            open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("could not open " + file_name);
+
+        format = _format;
+        // a pipe has nowhere to say which frames were dropped, and the
+        // frame rate in the header is only right with none dropped
+        skip_duplicates = Config::VIDEO_SKIP_DUPLICATE_FRAMES && file_name != "-";
+        if (skip_duplicates)
+        {
+            frames_fp = fopen((file_name + ".frames").c_str(), "w");
+            if (frames_fp == NULL)
+            {
+                close(fd);
+                fd = -1;
+                throw std::runtime_error("could not open " + file_name + ".frames");
+            }
+        }
+        slots.resize(QUEUE_SLOTS);
+        const u32 f = scale_factor();
+        scaled.resize(f > 1 ? FRAME_PIXELS * f * f : 0);
+        out.reserve(WRITE_BUFFER_BYTES + 4 * FRAME_PIXELS * f * f);
+        head = tail = 0;
+        have_last_hash = false;
+        failure = nullptr;
+
+        // a reader that went away, such as an encoder at the end of a
+        // pipe, should fail the write with EPIPE rather than kill us
+        struct sigaction ignore {};
+        ignore.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &ignore, &sigpipe);
+
+        if (format == Format::Y4M)
+        {
+            char header[64];
+            int n = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1000 Ip A1:1 C444\n",
+                             DISPLAY_WIDTH * f, DISPLAY_HEIGHT * f,
+                             static_cast<u32>(Config::FRAMERATE * 1000));
+            out.insert(out.end(), header, header + n);
+        }
+
+        running = true;
+        writer = std::thread(writer_loop);
+    }
+
+    /* Queue the current display contents, blocking only
+       when the writer has fallen QUEUE_SLOTS frames behind */
+    void push_frame()
+    {
+        if (!running) return;
+
+        if (skip_duplicates)
+        {
+            u32 hash = Display::get_buffer_hash();
+            if (have_last_hash && hash == last_hash) return;
+            last_hash = hash;
+            have_last_hash = true;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [] { return head - tail < QUEUE_SLOTS || failure; });
+        if (failure) return;
+        Slot &slot = slots[head % QUEUE_SLOTS];
+        lock.unlock();
+
+        memcpy(slot.rgb.data(), Display::frame(), sizeof(slot.rgb));
+        memcpy(slot.colors.data(), Display::frame_colors(), sizeof(slot.colors));
+        slot.frame = PPU::frame_count;
+
+        lock.lock();
+        head++;
+        not_empty.notify_one();
+    }
+
+    void stop()
+    {
+        if (!running) return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        not_empty.notify_one();
+        writer.join();
+
+        if (fd != STDOUT_FILENO) close(fd);
+        fd = -1;
+        if (frames_fp != NULL) fclose(frames_fp);
+        frames_fp = NULL;
+        sigaction(SIGPIPE, &sigpipe, NULL);
+
+        if (failure)
+        {
+            std::exception_ptr error = failure;
+            failure = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    bool active()
+    {
+        return running;
+    }
+}
@@ -0,0 +1,182 @@
+// Runs the TEST_LIST in src/autotest.cpp headless. Every test gets
+// a process of its own, as the emulator is one machine per process,
+// and up to one per core run at once; a test that throws or crashes
+// fails alone. Each one stops at its expected frame hash or fails
+// after the frame budget.
+//
+//     autotest [name filter] [-j jobs] [--frames budget]
+//
+// Exits 1 if any test failed, other than those TEST_LIST marks as
+// known failures, which are reported as XFAIL (or XPASS once fixed).
+// Where there is no fork the tests run one after another in this
+// process.
+
+#include "autotest.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#ifdef __unix__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+const u64 DEFAULT_FRAMES = 300;
+
+using Clock = std::chrono::steady_clock;
+
+// what a test process sends back
+struct Report
+{
+    Autotest::Result result;
+    char error[120]; // what it threw, if it did
+};
+
+Report run_test(const Autotest &test, u64 frames)
+{
+    Report report {};
+    try
+    {
+        report.result = test.run(frames);
+    }
+    catch (const std::exception &e)
+    {
+        snprintf(report.error, sizeof(report.error), "%s", e.what());
+    }
+    catch (const char *e)
+    {
+        snprintf(report.error, sizeof(report.error), "%s", e);
+    }
+    return report;
+}
+
+// tests that didn't pass
+struct Tally
+{
+    u32 failed = 0;
+    u32 known = 0; // of them, known failures
+};
+
+// prints the test's line and counts it if it didn't pass
+void print_report(const Autotest &test, const Report &report, double seconds, Tally &tally)
+{
+    const Autotest::Result &r = report.result;
+    const char *verdict = test.known_failure() ? (r.passed ? "XPASS" : "XFAIL") : (r.passed ? "PASS" : "FAIL");
+    printf("%-26s %-5s %7.2fs %6lu frames  %08X", test.name().c_str(),
+           verdict, seconds, r.frames, r.display_hash);
+    if (report.error[0] != 0) printf("  threw: %s", report.error);
+    else if (!r.passed) printf("  budget ran out");
+    printf("\n");
+    fflush(stdout);
+    if (r.passed) return;
+    tally.failed++;
+    if (test.known_failure()) tally.known++;
+}
+
+#ifdef __unix__
+
+struct Job
+{
+    const Autotest *test;
+    pid_t pid;
+    int fd;
+    Clock::time_point start;
+};
+
+Tally run_all(const vector<const Autotest *> &tests, u64 frames, u32 jobs)
+{
+    Tally tally;
+    vector<Job> running;
+    size_t next = 0;
+    while (next < tests.size() || !running.empty())
+    {
+        while (next < tests.size() && running.size() < jobs)
+        {
+            int fds[2];
+            if (pipe(fds) != 0)
+                throw std::runtime_error("pipe failed");
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid < 0)
+                throw std::runtime_error("fork failed");
+            if (pid == 0)
+            {
+                close(fds[0]);
+                Report report = run_test(*tests[next], frames);
+                ssize_t written = write(fds[1], &report, sizeof(report));
+                _exit(written == sizeof(report) ? 0 : 1);
+            }
+            close(fds[1]);
+            running.push_back({ tests[next++], pid, fds[0], Clock::now() });
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        auto job = std::find_if(running.begin(), running.end(), [pid](const Job &j) { return j.pid == pid; });
+        if (job == running.end()) continue;
+        double seconds = std::chrono::duration<double>(Clock::now() - job->start).count();
+
+        Report report {};
+        if (read(job->fd, &report, sizeof(report)) != sizeof(report))
+        {
+            if (WIFSIGNALED(status))
+                snprintf(report.error, sizeof(report.error), "crashed with signal %d", WTERMSIG(status));
+            else
+                snprintf(report.error, sizeof(report.error), "exited with %d", WEXITSTATUS(status));
+        }
+        close(job->fd);
+        print_report(*job->test, report, seconds, tally);
+        running.erase(job);
+    }
+    return tally;
+}
+
+#else
+
+Tally run_all(const vector<const Autotest *> &tests, u64 frames, u32 jobs)
+{
+    Tally tally;
+    for (const Autotest *test : tests)
+    {
+        auto start = Clock::now();
+        Report report = run_test(*test, frames);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        print_report(*test, report, seconds, tally);
+    }
+    return tally;
+}
+
+#endif
+
+int main(int argc, char *argv[])
+{
+    string filter;
+    u64 frames = DEFAULT_FRAMES;
+    u32 jobs = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) jobs = std::max(1, atoi(argv[++i]));
+        else if (arg == "--frames" && i + 1 < argc) frames = std::max(1, atoi(argv[++i]));
+        else filter = arg;
+    }
+
+#ifdef __unix__
+    // no window needed when SDL has a driver that skips it
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+#endif
+
+    vector<const Autotest *> tests;
+    for (const Autotest &test : TEST_LIST)
+        if (test.name().find(filter) != string::npos) tests.push_back(&test);
+
+    auto start = Clock::now();
+    Tally tally = run_all(tests, frames, jobs);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    printf("%lu of %lu passed, %u known to fail, in %.2fs, %u at a time\n",
+           tests.size() - tally.failed, tests.size(), tally.known, seconds, jobs);
+    return tally.failed > tally.known ? 1 : 0;
+}
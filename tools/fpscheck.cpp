@@ -0,0 +1,190 @@
+// Headless end-to-end regression check. Runs every ROM listed in a
+// baseline file for its number of frames with its scripted input,
+// then compares emulated frames per second and the final frame hash
+// with the recorded ones. Fails when a hash changes or when the frame
+// rate drops more than the threshold below the baseline.
+//
+//     fpscheck [baseline] [--threshold 0.15] [--runs 3] [--update]
+//
+// --update records the measured rates and hashes as the new baseline.
+// Rates depend on the machine and the build, so record baselines on
+// the machine and with the make flags the check will run with.
+
+#include "console.hpp"
+#include "ppu.hpp"
+#include "display.hpp"
+#include "input.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+const char *DEFAULT_BASELINE = "tools/fps_baseline.txt";
+const array<const char *, 8> BUTTON_NAMES { "a", "b", "select", "start", "up", "down", "left", "right" };
+
+// a button held from frame first up to and including frame last
+struct Press
+{
+    u32 button;
+    u64 first;
+    u64 last;
+};
+
+struct Entry
+{
+    string rom;
+    u64 frames;
+    double fps;
+    double instructions_per_second;
+    u32 hash;
+    string input; // as written in the file, "-" for none
+    vector<Press> presses;
+};
+
+// "start:60-64,right:120-240"
+vector<Press> parse_input(const string &text)
+{
+    vector<Press> presses;
+    if (text == "-") return presses;
+
+    std::istringstream in(text);
+    string item;
+    while (std::getline(in, item, ','))
+    {
+        size_t colon = item.find(':');
+        size_t dash = item.find('-', colon);
+        if (colon == string::npos || dash == string::npos)
+            throw std::invalid_argument("expected button:first-last, got " + item);
+
+        auto name = std::find(BUTTON_NAMES.begin(), BUTTON_NAMES.end(), item.substr(0, colon));
+        if (name == BUTTON_NAMES.end())
+            throw std::invalid_argument("unknown button in " + item);
+        presses.push_back({ static_cast<u32>(name - BUTTON_NAMES.begin()),
+                            std::stoull(item.substr(colon + 1, dash - colon - 1)),
+                            std::stoull(item.substr(dash + 1)) });
+    }
+    return presses;
+}
+
+vector<Entry> load_baseline(const string &file_name)
+{
+    std::ifstream in(file_name);
+    if (!in)
+        throw std::runtime_error("could not open " + file_name);
+
+    vector<Entry> entries;
+    string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        Entry e;
+        string hash;
+        if (!(fields >> e.rom >> e.frames >> e.fps >> e.instructions_per_second >> hash >> e.input))
+            throw std::runtime_error("bad baseline line: " + line);
+        e.hash = std::stoul(hash, nullptr, 16);
+        e.presses = parse_input(e.input);
+        entries.push_back(e);
+    }
+    return entries;
+}
+
+void save_baseline(const string &file_name, const vector<Entry> &entries)
+{
+    FILE *fp = fopen(file_name.c_str(), "w");
+    if (fp == NULL)
+        throw std::runtime_error("could not open " + file_name);
+
+    fprintf(fp, "# fpscheck baseline, see tools/fpscheck.cpp. Rates depend on the\n"
+                "# machine and build; regenerate with make fpsbaseline.\n"
+                "# input holds buttons over frame ranges: button:first-last,...\n");
+    fprintf(fp, "# %-26s %7s %10s %14s %9s  %s\n", "rom", "frames", "fps", "instr/s", "hash", "input");
+    for (const Entry &e : entries)
+        fprintf(fp, "%-28s %7lu %10.1f %14.0f  %08X  %s\n", e.rom.c_str(), e.frames, e.fps,
+                e.instructions_per_second, e.hash, e.input.c_str());
+    fclose(fp);
+}
+
+// runs the entry's ROM from power on; fills in the measurements
+void run(Entry &e)
+{
+    Console::init(e.rom);
+    for (u32 button = 0; button < BUTTON_NAMES.size(); button++)
+        Input::controller1.setButton(button, false);
+
+    u64 instructions = Metrics::get(Metrics::Counter::Instructions);
+    auto start = std::chrono::steady_clock::now();
+    while (PPU::frame_count < e.frames)
+    {
+        u64 frame = PPU::frame_count;
+        for (const Press &p : e.presses)
+            Input::controller1.setButton(p.button, frame >= p.first && frame <= p.last);
+        while (PPU::frame_count == frame) Console::execute();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    e.fps = e.frames / seconds;
+    e.instructions_per_second = (Metrics::get(Metrics::Counter::Instructions) - instructions) / seconds;
+    e.hash = Display::get_buffer_hash();
+    Console::deinit();
+}
+
+int main(int argc, char *argv[])
+{
+    string baseline_name = DEFAULT_BASELINE;
+    double threshold = 0.15;
+    u32 runs = 3;
+    bool update = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--threshold" && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (arg == "--runs" && i + 1 < argc) runs = std::max(1, atoi(argv[++i]));
+        else if (arg == "--update") update = true;
+        else baseline_name = arg;
+    }
+
+    vector<Entry> baseline = load_baseline(baseline_name);
+    vector<Entry> measured = baseline;
+    u32 failures = 0;
+
+    printf("%-28s %10s %10s %7s %14s  %-8s  %s\n", "rom", "fps", "baseline", "change", "instr/s", "hash", "");
+    for (u32 i = 0; i < baseline.size(); i++)
+    {
+        // the fastest run is the least disturbed by the rest of the machine
+        Entry &m = measured[i];
+        Entry best = m;
+        best.fps = 0;
+        for (u32 r = 0; r < runs; r++)
+        {
+            run(m);
+            if (m.fps > best.fps) best = m;
+        }
+        m = best;
+
+        const Entry &b = baseline[i];
+        double change = m.fps / b.fps - 1;
+        const char *verdict = "ok";
+        if (m.hash != b.hash) verdict = "FAIL: frame hash changed";
+        else if (change < -threshold) verdict = "FAIL: slower";
+
+        printf("%-28s %10.1f %10.1f %+6.1f%% %14.0f  %08X  %s\n", m.rom.c_str(), m.fps, b.fps,
+               100 * change, m.instructions_per_second, m.hash, update ? "" : verdict);
+        if (verdict[0] == 'F') failures++;
+    }
+
+    if (update)
+    {
+        save_baseline(baseline_name, measured);
+        printf("wrote %s\n", baseline_name.c_str());
+        return 0;
+    }
+    if (failures > 0)
+    {
+        printf("%u of %lu failed\n", failures, baseline.size());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+// Compiles the text game database into the file the loader maps, see
+// gamedb.hpp. Each line of the text form is
+//
+//     crc mapper[.submapper] mirroring prg_ram battery name
+//
+// crc being the CRC-32 of PRG then CHR in hex, mirroring one of H, V,
+// 0, 1 and 4 (single screen and four screen), prg_ram in bytes and
+// battery 0 or 1; # starts a comment. romscan prints ROMs in this form.
+//
+//     gamedb roms/gamedb.txt roms/gamedb.bin
+
+#include "gamedb.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+struct Line
+{
+    GameDatabase::Entry entry;
+    string name;
+};
+
+Line parse(const string &text, u32 number)
+{
+    std::istringstream fields(text);
+    string crc, mapper, mirroring;
+    u32 prg_ram, battery;
+    Line line {};
+    if (!(fields >> crc >> mapper >> mirroring >> prg_ram >> battery) || mirroring.size() != 1 ||
+        strchr(GameDatabase::MIRRORING, mirroring[0]) == NULL || battery > 1)
+        throw std::invalid_argument("gamedb line " + std::to_string(number) + " is malformed");
+    std::getline(fields >> std::ws, line.name);
+
+    size_t dot = mapper.find('.');
+    u32 submapper = dot == string::npos ? 0 : std::stoul(mapper.substr(dot + 1));
+    line.entry.crc = std::stoul(crc, NULL, 16);
+    line.entry.mapper = std::stoul(mapper.substr(0, dot));
+    line.entry.mirror_mode = strchr(GameDatabase::MIRRORING, mirroring[0]) - GameDatabase::MIRRORING;
+    line.entry.prg_ram_size = prg_ram;
+    line.entry.flags = (battery ? GameDatabase::BATTERY : 0) | (submapper & 0xF) << 4;
+    return line;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        printf("usage: %s gamedb.txt gamedb.bin\n", argv[0]);
+        return 1;
+    }
+
+    std::ifstream in(argv[1]);
+    if (!in)
+        throw std::runtime_error(string("could not open ") + argv[1]);
+    vector<Line> lines;
+    string text;
+    for (u32 number = 1; std::getline(in, text); number++)
+    {
+        text = text.substr(0, text.find('#'));
+        if (text.find_first_not_of(" \t\r") == string::npos) continue;
+        lines.push_back(parse(text, number));
+    }
+
+    std::sort(lines.begin(), lines.end(), [](const Line &a, const Line &b) { return a.entry.crc < b.entry.crc; });
+    for (size_t i = 1; i < lines.size(); i++)
+        if (lines[i].entry.crc == lines[i - 1].entry.crc)
+        {
+            char message[64];
+            snprintf(message, sizeof(message), "CRC %08X is in the database twice", lines[i].entry.crc);
+            throw std::invalid_argument(message);
+        }
+
+    string names;
+    for (Line &line : lines)
+    {
+        line.entry.name = names.size();
+        names += line.name;
+        names += '\0';
+    }
+
+    GameDatabase::Header header;
+    memcpy(header.magic, "NESGDB01", sizeof(header.magic));
+    header.entries = lines.size();
+    header.names_size = names.size();
+
+    FILE *fp = fopen(argv[2], "wb");
+    if (fp == NULL)
+        throw std::runtime_error(string("could not open ") + argv[2]);
+    fwrite(&header, sizeof(header), 1, fp);
+    for (const Line &line : lines) fwrite(&line.entry, sizeof(line.entry), 1, fp);
+    fwrite(names.data(), 1, names.size(), fp);
+    fclose(fp);
+    printf("%lu games\n", lines.size());
+    return 0;
+}
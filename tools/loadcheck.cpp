@@ -0,0 +1,81 @@
+// Loads ROM files with hand-made headers through Cartridge::open and
+// checks each is rejected with std::invalid_argument, or loaded with
+// the sizes it declares, rather than read past the end of the file.
+// The files are written to a temporary directory and removed after.
+//
+//     loadcheck
+//
+// Exits 1 if any case failed; make test runs it.
+
+#include "cartridge.hpp"
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <unistd.h>
+
+struct Case
+{
+    const char *name;
+    array<u8, 16> header;
+    size_t body;   // bytes after the header
+    bool accepted;
+    u32 prg_size;  // when accepted
+    u32 chr_size;
+};
+
+// bytes 4 and 5 count PRG and CHR; in NES 2.0 headers, byte 7 is 0x08
+// and byte 9 holds their MSB nibbles, F meaning 2^E * (2M + 1) bytes
+const Case CASES[] {
+    { "iNES, 16KB PRG and 8KB CHR", { 'N', 'E', 'S', 26, 1, 1 }, 0x6000, true, 0x4000, 0x2000 },
+    { "iNES, PRG past the end", { 'N', 'E', 'S', 26, 2, 1 }, 0x6000, false },
+    { "iNES, trainer past the end", { 'N', 'E', 'S', 26, 0, 0, 0x04 }, 0x100, false },
+    { "NES 2.0, PRG exponent past 2^32", { 'N', 'E', 'S', 26, 0x84, 0, 0, 0x08, 0, 0x0F }, 0x100, false },
+    { "NES 2.0, CHR exponent past 2^32", { 'N', 'E', 'S', 26, 0, 0xFD, 0, 0x08, 0, 0xF0 }, 0x100, false },
+    { "NES 2.0, 4GB of PRG", { 'N', 'E', 'S', 26, 0x80, 0, 0, 0x08, 0, 0x0F }, 0x100, false },
+    { "NES 2.0, exponent sized PRG", { 'N', 'E', 'S', 26, 0x39, 0, 0, 0x08, 0, 0x0F }, 0xC000, true, 0xC000, 0x2000 },
+    { "NES 2.0, 24KB of PRG", { 'N', 'E', 'S', 26, 0x35, 0, 0, 0x08, 0, 0x0F }, 0x6000, false },
+    { "NES 2.0, 1 byte of CHR", { 'N', 'E', 'S', 26, 1, 0x00, 0, 0x08, 0, 0xF0 }, 0x6000, false },
+    { "NES 2.0, 24 bytes of CHR", { 'N', 'E', 'S', 26, 1, 0x0D, 0, 0x08, 0, 0xF0 }, 0x6000, false },
+    { "NES 2.0, 4KB of CHR", { 'N', 'E', 'S', 26, 1, 0x30, 0, 0x08, 0, 0xF0 }, 0x6000, false },
+};
+
+int main()
+{
+    char dir[] = "/tmp/loadcheck-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        throw std::runtime_error("could not make a temporary directory");
+
+    u32 failures = 0;
+    u32 number = 0;
+    for (const Case &c : CASES)
+    {
+        string file = string(dir) + "/" + std::to_string(number++) + ".nes";
+        FILE *fp = fopen(file.c_str(), "wb");
+        if (fp == NULL)
+            throw std::runtime_error("could not open " + file);
+        fwrite(c.header.data(), 1, c.header.size(), fp);
+        vector<u8> body(c.body);
+        fwrite(body.data(), 1, body.size(), fp);
+        fclose(fp);
+
+        string outcome;
+        bool passed;
+        try
+        {
+            auto image = Cartridge::open(file);
+            outcome = "loaded " + std::to_string(image->prg_size) + " + " + std::to_string(image->chr_size);
+            passed = c.accepted && image->prg_size == c.prg_size && image->chr_size == c.chr_size;
+        }
+        catch (const std::invalid_argument &e)
+        {
+            outcome = string("rejected: ") + e.what();
+            passed = !c.accepted;
+        }
+        printf("%-40s %s  %s\n", c.name, passed ? "PASS" : "FAIL", outcome.c_str());
+        failures += !passed;
+    }
+
+    std::filesystem::remove_all(dir);
+    printf("%u of %lu passed\n", static_cast<u32>(std::size(CASES)) - failures, std::size(CASES));
+    return failures > 0 ? 1 : 0;
+}
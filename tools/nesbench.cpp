@@ -0,0 +1,267 @@
+// Microbenchmarks of the emulator's hot paths, each run on state
+// from a ROM in roms/. Every benchmark is warmed up, then timed in
+// samples of at least SAMPLE_SECONDS; the median ns/op is reported
+// with the interquartile spread, and a benchmark whose spread stays
+// above MAX_SPREAD after MAX_ROUNDS rounds is marked unstable.
+//
+//     nesbench [name filter] [--samples n] [--save file] [--compare file]
+//
+// --save writes each benchmark's median to a file; --compare reads one
+// written by another build and adds how much faster this build is,
+// which is how make pgoreport measures the PGO build against -O3.
+// Run it from the repository root, on an otherwise idle machine.
+
+#include "console.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "display.hpp"
+#include "crc.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <stdexcept>
+
+const double SAMPLE_SECONDS = 0.01;
+const u32 WARMUP_SAMPLES = 3;
+const double MAX_SPREAD = 0.05;
+const u32 MAX_ROUNDS = 3;
+const u64 WARMUP_FRAMES = 120;
+
+const u16 NESTEST_AUTOMATION_PC = 0xC000;
+const u64 NESTEST_INSTRUCTIONS = 8000; // before it runs out of tests
+
+struct Result
+{
+    double median;
+    double fastest;
+    double spread; // interquartile range over the median
+};
+
+u32 samples = 15;
+volatile u32 sink; // keeps results of benchmarked reads alive
+FILE *save_file = NULL;
+std::map<string, double> reference; // median ns/op by name, from --compare
+
+double seconds_for(const std::function<void(u64)> &body, u64 ops)
+{
+    auto start = std::chrono::steady_clock::now();
+    body(ops);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+Result round(const std::function<void(u64)> &body, u64 ops)
+{
+    for (u32 i = 0; i < WARMUP_SAMPLES; i++) body(ops);
+
+    vector<double> ns(samples);
+    for (double &n : ns) n = seconds_for(body, ops) * 1e9 / ops;
+    std::sort(ns.begin(), ns.end());
+
+    Result r;
+    r.median = ns[ns.size() / 2];
+    r.fastest = ns.front();
+    r.spread = (ns[ns.size() * 3 / 4] - ns[ns.size() / 4]) / r.median;
+    return r;
+}
+
+// body(n) runs n operations
+void benchmark(const string &name, const string &filter, const std::function<void(u64)> &body)
+{
+    if (name.find(filter) == string::npos) return;
+
+    // grow the batch until a sample takes long enough to time
+    u64 ops = 1;
+    while (seconds_for(body, ops) < SAMPLE_SECONDS) ops *= 2;
+
+    Result best = round(body, ops);
+    for (u32 i = 1; i < MAX_ROUNDS && best.spread > MAX_SPREAD; i++)
+    {
+        Result r = round(body, ops);
+        if (r.spread < best.spread) best = r;
+    }
+
+    printf("%-28s %12.2f %12.2f %8.1f%%", name.c_str(), best.median, best.fastest, 100 * best.spread);
+    auto found = reference.find(name);
+    if (found != reference.end())
+        printf(" %12.2f %+7.1f%%", found->second, 100 * (found->second / best.median - 1));
+    printf("  %s\n", best.spread > MAX_SPREAD ? "unstable" : "");
+    fflush(stdout);
+
+    if (save_file != NULL)
+        fprintf(save_file, "%.4f %s\n", best.median, name.c_str());
+}
+
+// lines of "median name", as written by --save
+void load_reference(const string &file_name)
+{
+    std::ifstream in(file_name);
+    if (!in)
+        throw std::runtime_error("could not open " + file_name);
+
+    double median;
+    string name;
+    while (in >> median && std::getline(in >> std::ws, name))
+        reference[name] = median;
+}
+
+void load(const string &rom, u64 frames)
+{
+    Console::init(rom);
+    while (PPU::frame_count < frames) Console::execute();
+}
+
+void nestest_restart()
+{
+    CPU::reset();
+    CPU::setPC(NESTEST_AUTOMATION_PC);
+}
+
+void cpu_benchmarks(const string &filter)
+{
+    Console::init("roms/nestest.nes");
+    nestest_restart();
+    u64 executed = 0;
+    benchmark("cpu.step nestest", filter, [&](u64 n)
+    {
+        for (u64 i = 0; i < n; i++)
+        {
+            CPU::step();
+            if (++executed == NESTEST_INSTRUCTIONS)
+            {
+                nestest_restart();
+                executed = 0;
+            }
+        }
+    });
+    Console::deinit();
+
+    // whole instructions, with the PPU ticks they take
+    for (const string rom : { "dk", "mrio" })
+    {
+        load("roms/" + rom + ".nes", WARMUP_FRAMES);
+        benchmark("console.execute " + rom, filter, [](u64 n)
+        {
+            for (u64 i = 0; i < n; i++) Console::execute();
+        });
+        Console::deinit();
+    }
+}
+
+void bus_benchmarks(const string &filter)
+{
+    load("roms/dk.nes", WARMUP_FRAMES);
+
+    auto reads = [](u16 base, u16 mask)
+    {
+        return [base, mask](u64 n)
+        {
+            u32 sum = 0;
+            for (u64 i = 0; i < n; i++) sum += CPUMemory::read(base + (i & mask));
+            sink = sum;
+        };
+    };
+    benchmark("bus.read ram", filter, reads(0x0000, 0x07FF));
+    benchmark("bus.read ram mirrors", filter, reads(0x0800, 0x17FF));
+    benchmark("bus.read prg", filter, reads(0x8000, 0x7FFF));
+    benchmark("bus.read ppustatus", filter, reads(0x2002, 0));
+    benchmark("bus.read controller", filter, reads(0x4016, 0));
+
+    benchmark("bus.write ram", filter, [](u64 n)
+    {
+        for (u64 i = 0; i < n; i++) CPUMemory::write(0x0300 + (i & 0xFF), i);
+    });
+    Console::deinit();
+}
+
+void ppu_benchmarks(const string &filter)
+{
+    load("roms/dk.nes", WARMUP_FRAMES);
+
+    benchmark("ppu.tick", filter, [](u64 n)
+    {
+        for (u64 i = 0; i < n; i++) PPU::tick();
+    });
+
+    // on a visible line, put back afterwards
+    u32 line = PPU::scan_line;
+    u32 dot = PPU::dot;
+    PPU::scan_line = 100;
+    PPU::dot = 257;
+    benchmark("ppu.draw_row", filter, [](u64 n)
+    {
+        for (u64 i = 0; i < n; i++) PPU::draw_row();
+    });
+    benchmark("ppu.evaluate_sprites", filter, [](u64 n)
+    {
+        for (u64 i = 0; i < n; i++) PPU::evaluate_sprites();
+    });
+    PPU::scan_line = line;
+    PPU::dot = dot;
+
+    benchmark("oam.dma", filter, [](u64 n)
+    {
+        for (u64 i = 0; i < n; i++)
+        {
+            PPU::OAM::dma(0x02);
+            CPU::stall = 0;
+        }
+    });
+    Console::deinit();
+}
+
+void crc_benchmarks(const string &filter)
+{
+    load("roms/mrio.nes", WARMUP_FRAMES);
+    vector<u32> frame(Display::frame(), Display::frame() + DISPLAY_WIDTH * DISPLAY_HEIGHT);
+    Console::deinit();
+
+    for (CRCKernel kernel : { CRCKernel::Portable, CRCKernel::PCLMUL, CRCKernel::AVX2 })
+    {
+        if (!crc32_select_kernel(kernel)) continue;
+        string name = crc32_kernel_name();
+        benchmark("crc32 frame " + name, filter, [&](u64 n)
+        {
+            u32 crc = 0;
+            for (u64 i = 0; i < n; i++)
+                crc = crc32(reinterpret_cast<const u8 *>(frame.data()), frame.size() * sizeof(u32), crc);
+            sink = crc;
+        });
+        benchmark("frame_hash " + name, filter, [&](u64 n)
+        {
+            u32 hash = 0;
+            for (u64 i = 0; i < n; i++) hash += frame_hash(frame.data(), frame.size());
+            sink = hash;
+        });
+    }
+    crc32_select_kernel(CRCKernel::Auto);
+}
+
+int main(int argc, char *argv[])
+{
+    string filter;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--samples" && i + 1 < argc) samples = std::max(4, atoi(argv[++i]));
+        else if (arg == "--save" && i + 1 < argc)
+        {
+            save_file = fopen(argv[++i], "w");
+            if (save_file == NULL)
+                throw std::runtime_error(string("could not open ") + argv[i]);
+        }
+        else if (arg == "--compare" && i + 1 < argc) load_reference(argv[++i]);
+        else filter = arg;
+    }
+
+    printf("%-28s %12s %12s %9s", "benchmark", "ns/op", "fastest", "spread");
+    if (!reference.empty()) printf(" %12s %8s", "reference", "speedup");
+    printf("\n");
+    cpu_benchmarks(filter);
+    bus_benchmarks(filter);
+    ppu_benchmarks(filter);
+    crc_benchmarks(filter);
+    if (save_file != NULL) fclose(save_file);
+    return 0;
+}
@@ -0,0 +1,252 @@
+// Coverage-guided fuzzing of the CPU and PPU on a real game. The ROM
+// is loaded and run for WARM_FRAMES once; every input then starts from
+// that snapshot, restored in place rather than through Console::init,
+// and runs at most NES_FUZZ_INSTRUCTIONS instructions, the knob that
+// trades depth for runs per second. The feedback is which PRG bytes
+// the run used as code or data, from the code/data log.
+//
+// An input is one byte of controller 1 buttons per frame, except that
+// 0xFF pokes RAM instead: the next three bytes are the address, low
+// byte first and taken modulo the 2KB, and the value. A frame's byte
+// holds until the frame ends or the budget runs out. Exceptions and
+// failed bounds checks abort, which is what the fuzzer looks for.
+//
+// Every instruction is emulated in full, so a run costs what the
+// emulator does. Measured with the release driver on dk on one core:
+// about 80 runs/s at the default budget, 500 at 4000 instructions and
+// 2500 at 400, the restore and coverage scan then taking most of it.
+// The tens of thousands a second libFuzzer likes aren't in reach
+// without runs too short to get anywhere.
+//
+// make fuzz builds nesfuzz-fuzz with clang's libFuzzer and
+// AddressSanitizer (NES_LIBFUZZER); run it with NES_FUZZ_ROM set to
+// the ROM and libFuzzer's usual flags. That build has not been
+// compiled yet, no clang having been at hand, so treat it
+// as untested. The plain build has its own small driver instead:
+//
+//     nesfuzz [--runs n] [--seed n] [--instructions n] [crash inputs to replay...]
+//
+// which mutates a corpus for n runs, keeping inputs that reach new
+// PRG bytes, and writes crash-<n> when an input throws.
+
+#include "console.hpp"
+#include "ppu.hpp"
+#include "input.hpp"
+#include "savestate.hpp"
+#include "codedatalog.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+const char *DEFAULT_ROM = "roms/dk.nes";
+const u64 WARM_FRAMES = 120;
+const u64 DEFAULT_INSTRUCTIONS = 40000; // about four frames
+const u8 POKE = 0xFF;
+const u32 COVERAGE_COUNTERS = 1 << 16; // PRG offsets are folded into these
+
+vector<u8> warm;
+u64 max_instructions = DEFAULT_INSTRUCTIONS;
+
+#ifdef NES_LIBFUZZER
+// libFuzzer reads these after every run as extra coverage
+__attribute__((used, section("__libfuzzer_extra_counters")))
+u8 prg_counters[COVERAGE_COUNTERS];
+#endif
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    const char *rom = getenv("NES_FUZZ_ROM");
+    const char *instructions = getenv("NES_FUZZ_INSTRUCTIONS");
+    if (instructions != NULL) max_instructions = std::max(1ll, atoll(instructions));
+
+    Console::init(rom != NULL ? rom : DEFAULT_ROM);
+    while (PPU::frame_count < WARM_FRAMES) Console::execute();
+    warm = SaveState::save();
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+    SaveState::load(warm);
+    std::fill(CodeDataLog::prg.begin(), CodeDataLog::prg.end(), 0);
+    CodeDataLog::cpu_kind = CodeDataLog::NONE; // in case the last run threw
+
+    u64 budget = max_instructions;
+    size_t i = 0;
+    while (i < size && budget > 0)
+    {
+        if (data[i] == POKE)
+        {
+            if (i + 3 >= size) break;
+            Console::ram[(data[i + 1] | data[i + 2] << 8) % CONSOLE_RAM_BYTES] = data[i + 3];
+            i += 4;
+            continue;
+        }
+
+        Input::controller1.setButtons(data[i++]);
+        u64 frame = PPU::frame_count;
+        while (PPU::frame_count == frame && budget > 0)
+        {
+            Console::execute();
+            budget--;
+        }
+    }
+
+#ifdef NES_LIBFUZZER
+    for (u32 offset = 0; offset < CodeDataLog::prg.size(); offset++)
+        if (CodeDataLog::prg[offset] != 0) prg_counters[offset % COVERAGE_COUNTERS] = 1;
+#endif
+    return 0;
+}
+
+#ifndef NES_LIBFUZZER
+
+const size_t MAX_INPUT = 64;
+
+void save_input(const string &file_name, const vector<u8> &input)
+{
+    FILE *fp = fopen(file_name.c_str(), "wb");
+    if (fp == NULL)
+        throw std::runtime_error("could not open " + file_name);
+    fwrite(input.data(), 1, input.size(), fp);
+    fclose(fp);
+}
+
+vector<u8> load_input(const string &file_name)
+{
+    FILE *fp = fopen(file_name.c_str(), "rb");
+    if (fp == NULL)
+        throw std::runtime_error("could not open " + file_name);
+    vector<u8> input;
+    int c;
+    while ((c = fgetc(fp)) != EOF) input.push_back(c);
+    fclose(fp);
+    return input;
+}
+
+void mutate(vector<u8> &input, std::mt19937 &rng)
+{
+    auto random = [&rng](u32 n) { return static_cast<u32>(rng() % n); };
+    switch (random(input.empty() ? 1 : 5))
+    {
+        case 0: // insert a frame of input or a poke
+            if (input.size() >= MAX_INPUT) break;
+            if (random(4) == 0)
+            {
+                u8 poke[] = { POKE, static_cast<u8>(rng()), static_cast<u8>(rng()), static_cast<u8>(rng()) };
+                input.insert(input.begin() + random(input.size() + 1), poke, poke + 4);
+            }
+            else input.insert(input.begin() + random(input.size() + 1), static_cast<u8>(random(POKE)));
+            break;
+        case 1:
+            input.erase(input.begin() + random(input.size()));
+            break;
+        case 2:
+            input[random(input.size())] ^= 1 << random(8);
+            break;
+        case 3:
+            input[random(input.size())] = rng();
+            break;
+        case 4: // repeat a byte, holding buttons longer
+            input.insert(input.begin() + random(input.size()), input[random(input.size())]);
+            break;
+    }
+}
+
+// runs an input, returning what it threw, if anything. The machine
+// may be left mid-instruction, but every run starts from the snapshot.
+string run_input(const vector<u8> &input)
+{
+    try
+    {
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    catch (const std::exception &e)
+    {
+        return e.what();
+    }
+    catch (const char *e)
+    {
+        return e;
+    }
+    return "";
+}
+
+// true when the run used PRG bytes no run before it did
+bool new_coverage(vector<u8> &seen)
+{
+    bool found = false;
+    for (u32 offset = 0; offset < seen.size(); offset++)
+    {
+        u8 flags = CodeDataLog::prg[offset];
+        if ((flags & ~seen[offset]) == 0) continue;
+        seen[offset] |= flags;
+        found = true;
+    }
+    return found;
+}
+
+int main(int argc, char *argv[])
+{
+    u64 runs = 10000;
+    u32 seed = 1;
+    vector<string> replays;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc) runs = std::stoull(argv[++i]);
+        else if (arg == "--seed" && i + 1 < argc) seed = std::stoul(argv[++i]);
+        else if (arg == "--instructions" && i + 1 < argc) setenv("NES_FUZZ_INSTRUCTIONS", argv[++i], 1);
+        else replays.push_back(arg);
+    }
+
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    if (!replays.empty())
+    {
+        u32 thrown = 0;
+        for (const string &file_name : replays)
+        {
+            string error = run_input(load_input(file_name));
+            printf("%s: %s\n", file_name.c_str(), error.empty() ? "ok" : ("threw: " + error).c_str());
+            thrown += !error.empty();
+        }
+        return thrown > 0 ? 1 : 0;
+    }
+
+    std::mt19937 rng(seed);
+    vector<vector<u8>> corpus { {} };
+    vector<u8> seen(CodeDataLog::prg.size());
+    u64 crashes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (u64 run = 0; run < runs; run++)
+    {
+        vector<u8> input = corpus[rng() % corpus.size()];
+        for (u32 m = rng() % 4; m < 4; m++) mutate(input, rng);
+
+        string error = run_input(input);
+        if (!error.empty())
+        {
+            string name = "crash-" + std::to_string(crashes++);
+            save_input(name, input);
+            printf("run %lu: threw %s, wrote %s\n", run, error.c_str(), name.c_str());
+            continue;
+        }
+
+        if (new_coverage(seen))
+        {
+            corpus.push_back(input);
+            u64 covered = std::count_if(seen.begin(), seen.end(), [](u8 flags) { return flags != 0; });
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            printf("run %lu: %lu PRG bytes covered, corpus %lu, %.0f runs/s\n",
+                   run, covered, corpus.size(), (run + 1) / seconds);
+            fflush(stdout);
+        }
+    }
+    return crashes > 0 ? 1 : 0;
+}
+
+#endif
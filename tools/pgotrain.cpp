@@ -0,0 +1,85 @@
+// Headless training run for profile-guided builds. Plays every ROM in
+// roms/ from power on for a fixed number of frames, pressing buttons
+// from a seeded generator so every run feeds the same input, and
+// prints each ROM's final frame hash. make pgo builds this with
+// -fprofile-generate, runs it, and rebuilds everything with the
+// collected profile.
+//
+//     pgotrain [frames per ROM] [--roms dir]
+//
+// The ROMs cover the CPU test, both games and the PPU tests, so the
+// profile weighs the instruction decoder, the renderer and the bus
+// the way real play does.
+
+#include "console.hpp"
+#include "ppu.hpp"
+#include "display.hpp"
+#include "input.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+const u64 DEFAULT_FRAMES = 600;
+const u64 FRAMES_PER_INPUT = 8; // how long each button state is held
+
+// xorshift32, so the input is the same on every machine
+struct Generator
+{
+    u32 state;
+
+    u32 next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+void train(const string &rom, u64 frames, u32 seed)
+{
+    Console::init(rom);
+    Generator generator { seed };
+    while (PPU::frame_count < frames)
+    {
+        // each button down a quarter of the time, start and select
+        // rarely, so games get past their title screens and stay there
+        u64 frame = PPU::frame_count;
+        if (frame % FRAMES_PER_INPUT == 0)
+        {
+            u32 bits = generator.next();
+            for (u32 button = 0; button < 8; button++)
+            {
+                bool menu = button == 2 || button == 3;
+                u32 chance = bits >> (button * 4) & 0xF;
+                Input::controller1.setButton(button, menu ? chance == 0 && frame % 256 == 0 : chance < 4);
+            }
+        }
+        while (PPU::frame_count == frame) Console::execute();
+    }
+    printf("%-28s %7lu  %08X\n", rom.c_str(), frames, Display::get_buffer_hash());
+    Console::deinit();
+}
+
+int main(int argc, char *argv[])
+{
+    u64 frames = DEFAULT_FRAMES;
+    string rom_dir = "roms";
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--roms" && i + 1 < argc) rom_dir = argv[++i];
+        else frames = std::max(1, atoi(argv[i]));
+    }
+
+    vector<string> roms;
+    for (const auto &entry : std::filesystem::directory_iterator(rom_dir))
+        if (entry.path().extension() == ".nes") roms.push_back(entry.path().string());
+    if (roms.empty())
+        throw std::runtime_error("no .nes files in " + rom_dir);
+    std::sort(roms.begin(), roms.end());
+
+    for (u32 i = 0; i < roms.size(); i++)
+        train(roms[i], frames, i + 1);
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Route search for tool-assisted play, see search.hpp. Plays the ROM
+// from power on for the warm-up, pressing start halfway to get past
+// a title screen, then beam searches moves from there, scoring each
+// machine by a number read from RAM, bigger is better.
+//
+//     tasearch rom --score addrs [--warm frames] [--depth moves]
+//                  [--frames per move] [--beam width] [-j workers]
+//                  [--minimize] [--record movie]
+//
+// --score lists the RAM addresses in hex, most significant first, of
+// the number; 6D,86 would be the player's position in Super Mario Bros.
+// --record writes the warm-up and the best sequence as a movie that
+// nescpp --play replays.
+
+#include "search.hpp"
+#include "console.hpp"
+#include "ppu.hpp"
+#include "input.hpp"
+#include "movie.hpp"
+#include "savestate.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+const u64 DEFAULT_WARM_FRAMES = 240;
+const u64 START_HELD_FRAMES = 4;
+
+// A, B, left and right, as Controller::value()
+const u8 BUTTON_A = 0x01;
+const u8 BUTTON_B = 0x02;
+const u8 BUTTON_START = 0x08;
+const u8 BUTTON_LEFT = 0x40;
+const u8 BUTTON_RIGHT = 0x80;
+
+void run_frames(u8 buttons, u64 frames)
+{
+    Input::controller1.setButtons(buttons);
+    u64 end = PPU::frame_count + frames;
+    while (PPU::frame_count < end) Console::execute();
+}
+
+vector<u16> parse_addresses(const string &list)
+{
+    vector<u16> addresses;
+    std::stringstream stream(list);
+    string address;
+    while (std::getline(stream, address, ','))
+    {
+        u32 value = std::stoul(address, NULL, 16);
+        if (value >= CONSOLE_RAM_BYTES)
+            throw std::out_of_range("RAM address " + address + " is past 2KB");
+        addresses.push_back(value);
+    }
+    return addresses;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: %s rom --score addrs [--warm frames] [--depth moves] [--frames per move] "
+               "[--beam width] [-j workers] [--minimize] [--record movie]\n", argv[0]);
+        return 1;
+    }
+
+    string rom = argv[1];
+    u64 warm = DEFAULT_WARM_FRAMES;
+    string score_list;
+    bool minimize = false;
+    string movie;
+    Search::Options options;
+    options.moves = { 0, BUTTON_RIGHT, BUTTON_RIGHT | BUTTON_A, BUTTON_RIGHT | BUTTON_B,
+                      BUTTON_RIGHT | BUTTON_A | BUTTON_B, BUTTON_LEFT, BUTTON_A };
+    options.depth = 20;
+    options.frames_per_move = 8;
+    options.beam = 32;
+    options.workers = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 2; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--warm" && i + 1 < argc) warm = std::stoull(argv[++i]);
+        else if (arg == "--depth" && i + 1 < argc) options.depth = std::max(1, atoi(argv[++i]));
+        else if (arg == "--frames" && i + 1 < argc) options.frames_per_move = std::max(1, atoi(argv[++i]));
+        else if (arg == "--beam" && i + 1 < argc) options.beam = std::max(1, atoi(argv[++i]));
+        else if (arg == "-j" && i + 1 < argc) options.workers = std::max(1, atoi(argv[++i]));
+        else if (arg == "--score" && i + 1 < argc) score_list = argv[++i];
+        else if (arg == "--minimize") minimize = true;
+        else if (arg == "--record" && i + 1 < argc) movie = argv[++i];
+        else throw std::invalid_argument("unknown argument " + arg);
+    }
+
+    if (score_list.empty())
+        throw std::invalid_argument("--score is needed, the RAM addresses to maximize");
+    vector<u16> addresses = parse_addresses(score_list);
+    Search::Score score = [addresses, minimize](const array<u8, CONSOLE_RAM_BYTES> &ram)
+    {
+        double value = 0;
+        for (u16 address : addresses) value = value * 256 + ram[address];
+        return minimize ? -value : value;
+    };
+
+#ifdef __unix__
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+#endif
+    Console::init(rom);
+    if (!movie.empty()) Movie::record(movie);
+    run_frames(0, warm / 2);
+    run_frames(BUTTON_START, START_HELD_FRAMES);
+    run_frames(0, warm - std::min(warm, warm / 2 + START_HELD_FRAMES));
+
+    printf("searching from frame %lu, %lu byte snapshots, %u workers\n",
+           PPU::frame_count, SaveState::save().size(), options.workers);
+    fflush(stdout);
+    auto start = std::chrono::steady_clock::now();
+    Search::Result result = Search::run(options, score);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("score %.0f after %lu moves:", minimize ? -result.score : result.score, result.moves.size());
+    for (u8 move : result.moves) printf(" %02X", move);
+    printf("\n%lu clones played in %.2fs, %.0f/s, %.0f frames/s\n", result.clones, seconds,
+           result.clones / seconds, result.clones * options.frames_per_move / seconds);
+
+    if (!movie.empty())
+    {
+        for (u8 move : result.moves) run_frames(move, options.frames_per_move);
+        Movie::stop();
+        printf("wrote %s, %lu frames\n", movie.c_str(), PPU::frame_count);
+    }
+    Console::deinit();
+    return 0;
+}
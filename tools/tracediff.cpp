@@ -0,0 +1,264 @@
+// Runs a ROM in lockstep with a nestest-format reference log
+// (logs/accurate.log by default) and stops at the first
+// instruction whose state differs. Does the job of
+// logs/log_compare.py without writing or reading a log of our
+// own: the reference is mmap'd and parsed in place by column.
+
+#include "console.hpp"
+#include "cpu.hpp"
+#include "trace.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const u32 CONTEXT_LINES = 8;
+const u32 PROGRESS_INTERVAL = 100000000;
+
+// columns of a nestest log line
+const u32 COL_PC = 0;
+const u32 COL_BYTES = 6;
+const u32 COL_A = 50;
+const u32 COL_X = 55;
+const u32 COL_Y = 60;
+const u32 COL_P = 65;
+const u32 COL_SP = 71;
+const u32 COL_DOT = 78;
+const u32 COL_LINE = 82;
+const u32 COL_CYCLE = 90;
+const u32 MIN_LINE_LENGTH = COL_LINE + 3;
+
+struct MappedFile
+{
+    const char *data;
+    size_t size;
+
+    MappedFile(const string &file_name)
+    {
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("could not open " + file_name);
+
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+            throw std::runtime_error("could not stat " + file_name);
+
+        size = st.st_size;
+        void *base = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        close(fd);
+        if (base == MAP_FAILED)
+            throw std::runtime_error("could not map " + file_name);
+
+        madvise(base, size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(base);
+    }
+
+    ~MappedFile()
+    {
+        if (size > 0) munmap(const_cast<char *>(data), size);
+    }
+};
+
+// state of one reference line, parsed in place
+struct Expected
+{
+    const char *text;
+    u32 length;
+    u16 pc;
+    u8 bytes[3];
+    u8 size;
+    u8 a, x, y, p, sp;
+    u16 dot, line;
+    bool has_cycle;
+    u64 cycle;
+};
+
+i32 hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+bool parse_hex(const char *s, u32 digits, u32 &value)
+{
+    value = 0;
+    for (u32 i = 0; i < digits; i++)
+    {
+        i32 d = hex_digit(s[i]);
+        if (d < 0) return false;
+        value = (value << 4) | d;
+    }
+    return true;
+}
+
+// right-aligned decimal, as in "PPU: 21,  0"
+bool parse_dec(const char *s, u32 width, u32 &value)
+{
+    value = 0;
+    bool any = false;
+    for (u32 i = 0; i < width; i++)
+    {
+        if (s[i] == ' ' && !any) continue;
+        if (s[i] < '0' || s[i] > '9') return false;
+        value = value * 10 + (s[i] - '0');
+        any = true;
+    }
+    return any;
+}
+
+bool parse(const char *text, u32 length, Expected &e)
+{
+    if (length < MIN_LINE_LENGTH) return false;
+
+    u32 v;
+    e.text = text;
+    e.length = length;
+    if (!parse_hex(text + COL_PC, 4, v)) return false;
+    e.pc = v;
+
+    e.size = 0;
+    for (u32 i = 0; i < 3; i++)
+    {
+        if (!parse_hex(text + COL_BYTES + 3 * i, 2, v)) break;
+        e.bytes[e.size++] = v;
+    }
+    if (e.size == 0) return false;
+
+    u8 *fields[] = { &e.a, &e.x, &e.y, &e.p, &e.sp };
+    const u32 columns[] = { COL_A, COL_X, COL_Y, COL_P, COL_SP };
+    for (u32 i = 0; i < 5; i++)
+    {
+        if (!parse_hex(text + columns[i], 2, v)) return false;
+        *fields[i] = v;
+    }
+
+    if (!parse_dec(text + COL_DOT, 3, v)) return false;
+    e.dot = v;
+    if (!parse_dec(text + COL_LINE, 3, v)) return false;
+    e.line = v;
+
+    e.has_cycle = length > COL_CYCLE && memcmp(text + COL_CYCLE - 4, "CYC:", 4) == 0;
+    e.cycle = 0;
+    if (e.has_cycle)
+        for (u32 i = COL_CYCLE; i < length && text[i] >= '0' && text[i] <= '9'; i++)
+            e.cycle = e.cycle * 10 + (text[i] - '0');
+    return true;
+}
+
+// one line per differing field, empty if everything matches
+string compare(const Expected &e, const Trace::Record &r, u64 cycle_offset)
+{
+    string out;
+    char buf[96];
+    auto check = [&](const char *name, u64 expected, u64 got)
+    {
+        if (expected == got) return;
+        snprintf(buf, sizeof(buf), "    %-6s expected %llX, got %llX\n", name,
+                 static_cast<unsigned long long>(expected), static_cast<unsigned long long>(got));
+        out += buf;
+    };
+
+    check("PC", e.pc, r.pc);
+    check("opcode", e.bytes[0], r.bytes[0]);
+    for (u32 i = 1; i < e.size; i++) check("operand", e.bytes[i], r.bytes[i]);
+    check("A", e.a, r.a);
+    check("X", e.x, r.x);
+    check("Y", e.y, r.y);
+    check("SP", e.sp, r.sp);
+    if (e.p != r.p)
+    {
+        const char *names = "NV-BDIZC";
+        string flags;
+        for (u32 i = 0; i < 8; i++)
+            if (((e.p ^ r.p) >> (7 - i)) & 1) flags += names[i];
+        snprintf(buf, sizeof(buf), "    %-6s expected %02X, got %02X (flags %s differ)\n",
+                 "P", e.p, r.p, flags.c_str());
+        out += buf;
+    }
+
+    // the PPU position, derived from the cycle count like the logs
+    check("dot", e.dot, (r.cycle * 3) % 341);
+    check("line", e.line, ((3 * r.cycle) / 341) % 261);
+    if (e.has_cycle) check("cycle", e.cycle, r.cycle + cycle_offset);
+    return out;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("\n\tUsage: %s <romname>.nes [reference.log]\n", argv[0]);
+        return 1;
+    }
+
+    MappedFile reference(argc > 2 ? argv[2] : "logs/accurate.log");
+    Console::init(argv[1]);
+
+    struct Step
+    {
+        Expected expected;
+        Trace::Record record;
+    };
+    array<Step, CONTEXT_LINES> history;
+
+    const char *p = reference.data;
+    const char *end = reference.data + reference.size;
+    u64 count = 0;
+    u64 cycle_offset = 0;
+    while (p < end)
+    {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (eol == NULL) eol = end;
+        u32 length = eol - p;
+        if (length > 0 && p[length - 1] == '\r') length--;
+
+        const char *text = p;
+        p = eol + 1;
+        Expected e;
+        if (!parse(text, length, e))
+        {
+            if (length == 0) continue;
+            printf("Could not parse reference line %lu: %.*s\n", count + 1, length, text);
+            return 2;
+        }
+
+        if (count == 0)
+        {
+            // nestest's automated mode starts at $C000
+            // rather than at the reset vector
+            if (e.pc != CPU::PC) CPU::setPC(e.pc);
+            cycle_offset = e.cycle - CPU::cycles;
+        }
+
+        Step &step = history[count % CONTEXT_LINES];
+        step.expected = e;
+        step.record = Trace::capture();
+
+        string diff = compare(e, step.record, cycle_offset);
+        if (!diff.empty())
+        {
+            printf("Disagreement on line %lu\n\n", count + 1);
+            u64 first = count + 1 > CONTEXT_LINES ? count + 1 - CONTEXT_LINES : 0;
+            for (u64 i = first; i <= count; i++)
+            {
+                const Step &s = history[i % CONTEXT_LINES];
+                printf("%s good: %.*s\n", i == count ? ">>" : "  ", s.expected.length, s.expected.text);
+                printf("%s mine: %s\n", i == count ? ">>" : "  ", Trace::format(s.record).c_str());
+            }
+            printf("\n%s", diff.c_str());
+            return 1;
+        }
+
+        Console::execute();
+        count++;
+        if (count % PROGRESS_INTERVAL == 0)
+            fprintf(stderr, "%lu instructions matched\n", count);
+    }
+
+    printf("All %lu lines matched. CPU is likely correct.\n", count);
+    return 0;
+}
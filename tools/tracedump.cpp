@@ -0,0 +1,26 @@
+// Renders a binary trace from Trace::start_file / Trace::save
+// as text, in the logs/mylog.log format by default
+
+#include "trace.hpp"
+#include <cstring>
+
+int main(int argc, char *argv[])
+{
+    string trace_name;
+    Trace::Style style = Trace::Style::Log;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--console") == 0) style = Trace::Style::Console;
+        else trace_name = argv[i];
+    }
+
+    if (trace_name.empty())
+    {
+        printf("\n\tUsage: %s <trace> [--console] > mylog.log\n", argv[0]);
+        return 1;
+    }
+
+    for (const Trace::Record &record : Trace::load(trace_name))
+        printf("%s\n", Trace::format(record, style).c_str());
+    return 0;
+}